@@ -0,0 +1,250 @@
+#ifndef BENCH_COMMON_HPP
+#define BENCH_COMMON_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <bitcoin/watcher.hpp>
+
+/**
+ * Helpers shared by the benchmark programs.
+ * The benchmarks are not part of the library build; see `make bench`.
+ */
+namespace bench {
+
+/**
+ * Reproducible random data, so every run works on the same transactions.
+ */
+class random_source
+{
+public:
+    random_source(uint64_t seed=1)
+      : engine_(seed)
+    {
+    }
+
+    size_t below(size_t limit)
+    {
+        return engine_() % limit;
+    }
+
+    void fill(uint8_t* out, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
+            out[i] = static_cast<uint8_t>(engine_());
+    }
+
+    bc::hash_digest hash()
+    {
+        bc::hash_digest out;
+        fill(out.data(), out.size());
+        return out;
+    }
+
+private:
+    std::mt19937_64 engine_;
+};
+
+inline void write_4_bytes(bc::data_chunk& out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back(static_cast<uint8_t>(value >> 8*i));
+}
+
+inline void write_8_bytes(bc::data_chunk& out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+        out.push_back(static_cast<uint8_t>(value >> 8*i));
+}
+
+/**
+ * Writes a bitcoin variable-length integer. The scripts and lists in
+ * these transactions are all short, so one byte is always enough.
+ */
+inline void write_small_uint(bc::data_chunk& out, size_t value)
+{
+    BITCOIN_ASSERT(value < 0xfd);
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+/**
+ * Builds a serialized transaction spending the given outputs, each with
+ * a pay-to-pubkey-hash input script, and paying to `outputs` random
+ * pay-to-pubkey-hash addresses.
+ */
+inline bc::data_chunk make_raw_tx(random_source& random,
+    const std::vector<bc::output_point>& spends, size_t outputs)
+{
+    bc::data_chunk out;
+    write_4_bytes(out, 1);
+
+    write_small_uint(out, spends.size());
+    for (const auto& spend: spends)
+    {
+        out.insert(out.end(), spend.hash.begin(), spend.hash.end());
+        write_4_bytes(out, spend.index);
+
+        // A 72-byte signature push, then a 33-byte public key push:
+        uint8_t script[1 + 72 + 1 + 33];
+        random.fill(script, sizeof(script));
+        script[0] = 72;
+        script[1] = 0x30;
+        script[1 + 72] = 33;
+        script[1 + 72 + 1] = 0x02;
+        write_small_uint(out, sizeof(script));
+        out.insert(out.end(), script, script + sizeof(script));
+        write_4_bytes(out, 0xffffffff);
+    }
+
+    write_small_uint(out, outputs);
+    for (size_t i = 0; i < outputs; ++i)
+    {
+        write_8_bytes(out, 1000 + random.below(100000000));
+
+        // OP_DUP OP_HASH160 <20 bytes> OP_EQUALVERIFY OP_CHECKSIG:
+        uint8_t script[25] = {0x76, 0xa9, 20};
+        random.fill(script + 3, 20);
+        script[23] = 0x88;
+        script[24] = 0xac;
+        write_small_uint(out, sizeof(script));
+        out.insert(out.end(), script, script + sizeof(script));
+    }
+
+    write_4_bytes(out, 0);
+    return out;
+}
+
+/**
+ * Builds a set of synthetic wallet transactions. Most spend outputs
+ * of earlier ones, so the spend and utxo indexes have real work to do,
+ * and every output pays to a different address.
+ */
+inline std::vector<bc::transaction_type> make_txs(size_t count,
+    uint64_t seed=1)
+{
+    random_source random(seed);
+    std::vector<bc::output_point> unspent;
+    std::vector<bc::transaction_type> out;
+    out.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        // Spend one or two earlier outputs, or come from outside:
+        std::vector<bc::output_point> spends;
+        size_t inputs = 1 + random.below(2);
+        for (size_t j = 0; j < inputs; ++j)
+        {
+            if (unspent.size() < 16)
+            {
+                spends.push_back(bc::output_point{random.hash(),
+                    static_cast<uint32_t>(random.below(4))});
+                continue;
+            }
+            size_t pick = random.below(unspent.size());
+            spends.push_back(unspent[pick]);
+            unspent[pick] = unspent.back();
+            unspent.pop_back();
+        }
+
+        auto raw = make_raw_tx(random, spends, 2);
+        bc::transaction_type tx;
+        bc::satoshi_load(raw.begin(), raw.end(), tx);
+        auto tx_hash = bc::hash_transaction(tx);
+        unspent.push_back(bc::output_point{tx_hash, 0});
+        unspent.push_back(bc::output_point{tx_hash, 1});
+        out.push_back(std::move(tx));
+    }
+    return out;
+}
+
+inline libwallet::hash_list hash_txs(
+    const std::vector<bc::transaction_type>& txs)
+{
+    libwallet::hash_list out;
+    out.reserve(txs.size());
+    for (const auto& tx: txs)
+        out.push_back(bc::hash_transaction(tx));
+    return out;
+}
+
+/**
+ * Puts transactions into a database as unconfirmed, in large batches.
+ */
+template <typename Db>
+void fill_db(Db& db, const std::vector<bc::transaction_type>& txs)
+{
+    const size_t batch = 10000;
+    for (size_t i = 0; i < txs.size(); i += batch)
+    {
+        libwallet::tx_store::tx_entry_list entries;
+        for (size_t j = i; j < std::min(i + batch, txs.size()); ++j)
+            entries.emplace_back(txs[j], libwallet::tx_state::unconfirmed);
+        db.insert_batch(entries);
+    }
+}
+
+/**
+ * Measures elapsed wall-clock time.
+ */
+class stopwatch
+{
+public:
+    stopwatch()
+      : start_(std::chrono::steady_clock::now())
+    {
+    }
+
+    double seconds() const
+    {
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start_;
+        return elapsed.count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * Reads a numeric command-line argument, or returns the default.
+ */
+inline size_t arg(int argc, char** argv, int i, size_t fallback)
+{
+    if (i < argc)
+        return std::strtoull(argv[i], nullptr, 10);
+    return fallback;
+}
+
+/**
+ * The thread counts to try: powers of two, up to and including `most`.
+ */
+inline std::vector<unsigned> thread_counts(unsigned most)
+{
+    std::vector<unsigned> out;
+    for (unsigned i = 1; i < most; i *= 2)
+        out.push_back(i);
+    out.push_back(most);
+    return out;
+}
+
+inline unsigned hardware_threads()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+inline std::string rate(double count, double seconds)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(0) << count / seconds;
+    return out.str();
+}
+
+} // namespace bench
+
+#endif
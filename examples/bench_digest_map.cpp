@@ -0,0 +1,97 @@
+/**
+ * Compares digest_map, the table behind tx_db's rows, with the
+ * std::unordered_map it replaced.
+ *
+ * usage: bench_digest_map [max-rows]
+ *
+ * For 10k rows and up, by factors of ten, this times inserting random
+ * hashes, looking up hashes that are present and ones that aren't, and
+ * iterating over every row. The values are about the size of a tx_row.
+ */
+#include <unordered_map>
+#include <bitcoin/watcher/digest_map.hpp>
+#include "bench_common.hpp"
+
+struct row
+{
+    uint64_t fields[5];
+};
+
+struct timings
+{
+    double insert;
+    double hit;
+    double miss;
+    double iterate;
+};
+
+/**
+ * Runs every test against one kind of map.
+ * @return nanoseconds per row for each test.
+ */
+template <typename Map>
+timings run(const libwallet::hash_list& keys,
+    const libwallet::hash_list& missing)
+{
+    timings out;
+    Map map;
+    const double scale = 1e9 / keys.size();
+
+    bench::stopwatch insert_timer;
+    for (size_t i = 0; i < keys.size(); ++i)
+        map.insert(typename Map::value_type(keys[i], row{{i}}));
+    out.insert = insert_timer.seconds() * scale;
+
+    // Every test adds up what it finds, so none of them can skip work:
+    uint64_t total = 0;
+    bench::stopwatch hit_timer;
+    for (const auto& key: keys)
+        total += map.find(key)->second.fields[0];
+    out.hit = hit_timer.seconds() * scale;
+
+    bench::stopwatch miss_timer;
+    for (const auto& key: missing)
+        total += map.count(key);
+    out.miss = miss_timer.seconds() * scale;
+
+    bench::stopwatch iterate_timer;
+    for (const auto& entry: map)
+        total -= entry.second.fields[0];
+    out.iterate = iterate_timer.seconds() * scale;
+
+    if (total != 0)
+        std::cerr << "lookups disagree with iteration" << std::endl;
+    return out;
+}
+
+int main(int argc, char** argv)
+{
+    auto max_rows = bench::arg(argc, argv, 1, 1000000);
+
+    std::cout << "nanoseconds per row, digest_map / unordered_map:" <<
+        std::endl;
+    std::cout << "rows\tinsert\t\thit\t\tmiss\t\titerate" << std::endl;
+    for (size_t rows = 10000; rows <= max_rows; rows *= 10)
+    {
+        bench::random_source random(rows);
+        libwallet::hash_list keys, missing;
+        keys.reserve(rows);
+        missing.reserve(rows);
+        for (size_t i = 0; i < rows; ++i)
+        {
+            keys.push_back(random.hash());
+            missing.push_back(random.hash());
+        }
+
+        auto fast = run<libwallet::digest_map<row>>(keys, missing);
+        auto slow = run<std::unordered_map<bc::hash_digest, row>>(keys,
+            missing);
+
+        std::cout << std::fixed << std::setprecision(1) << rows << '\t' <<
+            fast.insert << " / " << slow.insert << '\t' <<
+            fast.hit << " / " << slow.hit << '\t' <<
+            fast.miss << " / " << slow.miss << '\t' <<
+            fast.iterate << " / " << slow.iterate << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+/**
+ * Measures how tx_db's load time scales with the number of decode threads.
+ *
+ * usage: bench_load [rows] [max-threads]
+ *
+ * This saves a synthetic database once, and then times load from memory
+ * and load_file from a scratch file, each into a fresh database, for
+ * 1 thread up to `max-threads`.
+ */
+#include <cstdio>
+#include <fstream>
+#include "bench_common.hpp"
+
+int main(int argc, char** argv)
+{
+    auto rows = bench::arg(argc, argv, 1, 500000);
+    auto max_threads = bench::arg(argc, argv, 2, 16);
+
+    auto txs = bench::make_txs(rows);
+    auto hashes = bench::hash_txs(txs);
+    bc::data_chunk data;
+    {
+        libwallet::tx_db db;
+        bench::fill_db(db, txs);
+        data = db.serialize();
+    }
+    txs.clear();
+
+    const char* path = "bench_load.tmp";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!file)
+        {
+            std::cerr << "cannot write " << path << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << rows << " rows, " << data.size() << " bytes:" << std::endl;
+    std::cout << "threads\tload s\tspeedup\tload_file s\tspeedup" << std::endl;
+    double first_load = 0, first_file = 0;
+    for (auto threads: bench::thread_counts(max_threads))
+    {
+        double load_time, file_time;
+        {
+            libwallet::tx_db db;
+            bench::stopwatch timer;
+            bool good = db.load(data, threads);
+            load_time = timer.seconds();
+            if (!good || !db.has_tx(hashes.back()))
+            {
+                std::cerr << "load failed" << std::endl;
+                std::remove(path);
+                return 1;
+            }
+        }
+        {
+            libwallet::tx_db db;
+            bench::stopwatch timer;
+            bool good = db.load_file(path, threads);
+            file_time = timer.seconds();
+            if (!good || !db.has_tx(hashes.back()))
+            {
+                std::cerr << "load_file failed" << std::endl;
+                std::remove(path);
+                return 1;
+            }
+        }
+        if (1 == threads)
+        {
+            first_load = load_time;
+            first_file = file_time;
+        }
+
+        std::cout << std::setprecision(3) << threads << '\t' <<
+            load_time << '\t' << first_load / load_time << '\t' <<
+            file_time << "\t\t" << first_file / file_time << std::endl;
+    }
+
+    std::remove(path);
+    return 0;
+}
@@ -0,0 +1,75 @@
+/**
+ * Compares tx_db's batched lookups against looking up one hash at a time.
+ *
+ * usage: bench_multi_get [rows] [lookups]
+ *
+ * For each batch size, this resolves the same random hashes, one in eight
+ * of them missing from the database, first with a get_tx_ptr and
+ * get_tx_height call per hash, and then with one get_txs and one
+ * get_heights call per batch.
+ */
+#include "bench_common.hpp"
+
+int main(int argc, char** argv)
+{
+    auto rows = bench::arg(argc, argv, 1, 100000);
+    auto lookups = bench::arg(argc, argv, 2, 1000000);
+
+    auto txs = bench::make_txs(rows);
+    auto hashes = bench::hash_txs(txs);
+    libwallet::tx_db db;
+    bench::fill_db(db, txs);
+    txs.clear();
+
+    bench::random_source random(2);
+    libwallet::hash_list queries;
+    queries.reserve(lookups);
+    for (size_t i = 0; i < lookups; ++i)
+    {
+        if (random.below(8))
+            queries.push_back(hashes[random.below(hashes.size())]);
+        else
+            queries.push_back(random.hash());
+    }
+
+    // Both runs count the hits, so neither can skip any work:
+    size_t loop_found = 0;
+    bench::stopwatch loop_timer;
+    for (const auto& tx_hash: queries)
+    {
+        if (db.get_tx_ptr(tx_hash))
+            ++loop_found;
+        db.get_tx_height(tx_hash);
+    }
+    auto loop_rate = lookups / loop_timer.seconds();
+
+    std::cout << rows << " rows, " << lookups << " hashes resolved, " <<
+        bench::rate(loop_rate, 1) << "/s one at a time:" << std::endl;
+    std::cout << "batch\tbatched/s\tspeedup" << std::endl;
+    for (size_t batch = 1; batch <= 1024; batch *= 4)
+    {
+        size_t batch_found = 0;
+        bench::stopwatch batch_timer;
+        for (size_t i = 0; i < lookups; i += batch)
+        {
+            auto end = std::min(i + batch, lookups);
+            libwallet::hash_list part(queries.begin() + i,
+                queries.begin() + end);
+            for (const auto& tx: db.get_txs(part))
+                if (tx)
+                    ++batch_found;
+            db.get_heights(part);
+        }
+        auto batch_rate = lookups / batch_timer.seconds();
+
+        if (batch_found != loop_found)
+        {
+            std::cerr << "batched lookups found " << batch_found <<
+                " transactions, not " << loop_found << std::endl;
+            return 1;
+        }
+        std::cout << batch << '\t' << bench::rate(batch_rate, 1) << "\t\t" <<
+            std::setprecision(2) << batch_rate / loop_rate << std::endl;
+    }
+    return 0;
+}
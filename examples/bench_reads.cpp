@@ -0,0 +1,111 @@
+/**
+ * Measures how tx_db read throughput scales with the number of readers.
+ *
+ * usage: bench_reads [rows] [max-threads] [milliseconds]
+ *
+ * Each reader looks up random transactions with has_tx, get_tx_ptr and
+ * get_tx_height. The "exclusive" column runs the same readers behind one
+ * extra mutex, the way every query ran before reads shared the lock.
+ * The second table repeats both runs while another thread serializes
+ * the database over and over.
+ */
+#include <atomic>
+#include <mutex>
+#include "bench_common.hpp"
+
+/**
+ * Runs the readers for the given time, and returns lookups per second.
+ * @param exclusive a mutex every call takes first, or nullptr.
+ */
+static double run_readers(libwallet::tx_db& db,
+    const libwallet::hash_list& hashes, unsigned threads,
+    size_t milliseconds, bool serializing, std::mutex* exclusive)
+{
+    std::atomic<bool> stop(false);
+    std::vector<size_t> counts(threads, 0);
+    std::vector<std::thread> workers;
+
+    bench::stopwatch timer;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t]()
+        {
+            bench::random_source random(t + 1);
+            size_t count = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                const auto& tx_hash = hashes[random.below(hashes.size())];
+                std::unique_lock<std::mutex> lock;
+                if (exclusive)
+                    lock = std::unique_lock<std::mutex>(*exclusive);
+                db.has_tx(tx_hash);
+                db.get_tx_ptr(tx_hash);
+                db.get_tx_height(tx_hash);
+                ++count;
+            }
+            counts[t] = count;
+        });
+    }
+    if (serializing)
+    {
+        workers.emplace_back([&]()
+        {
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                std::unique_lock<std::mutex> lock;
+                if (exclusive)
+                    lock = std::unique_lock<std::mutex>(*exclusive);
+                db.serialize(1);
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+    stop = true;
+    for (auto& worker: workers)
+        worker.join();
+    auto seconds = timer.seconds();
+
+    size_t total = 0;
+    for (auto count: counts)
+        total += count;
+    return total / seconds;
+}
+
+static void run_table(libwallet::tx_db& db, const libwallet::hash_list& hashes,
+    unsigned max_threads, size_t milliseconds, bool serializing)
+{
+    std::cout << (serializing ? "with a serialize running:" : "quiet:") <<
+        std::endl;
+    std::cout << "threads\texclusive/s\tshared/s\tspeedup" << std::endl;
+    for (auto threads: bench::thread_counts(max_threads))
+    {
+        std::mutex exclusive;
+        auto old_rate = run_readers(db, hashes, threads, milliseconds,
+            serializing, &exclusive);
+        auto new_rate = run_readers(db, hashes, threads, milliseconds,
+            serializing, nullptr);
+        std::cout << threads << '\t' << bench::rate(old_rate, 1) << "\t\t" <<
+            bench::rate(new_rate, 1) << "\t\t" << std::setprecision(2) <<
+            new_rate / old_rate << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    auto rows = bench::arg(argc, argv, 1, 100000);
+    auto max_threads = bench::arg(argc, argv, 2, bench::hardware_threads());
+    auto milliseconds = bench::arg(argc, argv, 3, 1000);
+
+    auto txs = bench::make_txs(rows);
+    auto hashes = bench::hash_txs(txs);
+    libwallet::tx_db db;
+    bench::fill_db(db, txs);
+    txs.clear();
+
+    std::cout << rows << " rows, lookups per second " <<
+        "(has_tx + get_tx_ptr + get_tx_height):" << std::endl;
+    run_table(db, hashes, max_threads, milliseconds, false);
+    run_table(db, hashes, max_threads, milliseconds, true);
+    return 0;
+}
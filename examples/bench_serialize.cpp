@@ -0,0 +1,60 @@
+/**
+ * Measures tx_db::serialize throughput against the number of encode threads.
+ *
+ * usage: bench_serialize [rows] [max-threads]
+ *
+ * One thread is the plain serial encoder. Every other run must produce
+ * exactly the same bytes, and the program fails if one doesn't. The last
+ * column times serialize_to into a sink that just counts the bytes,
+ * which never builds the whole blob in memory.
+ */
+#include "bench_common.hpp"
+
+int main(int argc, char** argv)
+{
+    auto rows = bench::arg(argc, argv, 1, 500000);
+    auto max_threads = bench::arg(argc, argv, 2, 16);
+
+    auto txs = bench::make_txs(rows);
+    libwallet::tx_db db;
+    bench::fill_db(db, txs);
+    txs.clear();
+
+    bc::data_chunk expected;
+    std::cout << rows << " rows:" << std::endl;
+    std::cout << "threads\tserialize MB/s\tspeedup\tserialize_to MB/s" <<
+        std::endl;
+    double first_rate = 0;
+    for (auto threads: bench::thread_counts(max_threads))
+    {
+        bench::stopwatch timer;
+        auto data = db.serialize(threads);
+        auto rate = data.size() / timer.seconds() / 1e6;
+
+        size_t streamed = 0;
+        auto sink = [&streamed](const uint8_t*, size_t size)
+        {
+            streamed += size;
+            return true;
+        };
+        bench::stopwatch stream_timer;
+        db.serialize_to(sink, threads);
+        auto stream_rate = streamed / stream_timer.seconds() / 1e6;
+
+        if (1 == threads)
+        {
+            expected = data;
+            first_rate = rate;
+        }
+        if (data != expected || streamed != expected.size())
+        {
+            std::cerr << threads << " threads wrote different bytes" <<
+                std::endl;
+            return 1;
+        }
+
+        std::cout << std::setprecision(3) << threads << '\t' << rate <<
+            "\t\t" << rate / first_rate << '\t' << stream_rate << std::endl;
+    }
+    return 0;
+}
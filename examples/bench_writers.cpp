@@ -0,0 +1,64 @@
+/**
+ * Measures insert throughput with many writers sharing one database,
+ * for a plain tx_db and for a tx_sharded_db.
+ *
+ * usage: bench_writers [rows] [max-writers] [shards]
+ *
+ * For 1 writer thread up to `max-writers`, this deals the same synthetic
+ * transactions out to the writers, which insert them one at a time into
+ * a fresh database of each kind.
+ */
+#include "bench_common.hpp"
+
+/**
+ * Inserts every transaction, spread over the writers.
+ * @return inserts per second.
+ */
+template <typename Db>
+double run_writers(Db& db, const std::vector<bc::transaction_type>& txs,
+    unsigned writers)
+{
+    std::vector<std::thread> threads;
+    bench::stopwatch timer;
+    for (unsigned w = 0; w < writers; ++w)
+    {
+        threads.emplace_back([&db, &txs, w, writers]()
+        {
+            for (size_t i = w; i < txs.size(); i += writers)
+                db.insert(txs[i], libwallet::tx_state::unconfirmed);
+        });
+    }
+    for (auto& thread: threads)
+        thread.join();
+    auto rate = txs.size() / timer.seconds();
+
+    if (db.get_utxos().empty())
+        std::cerr << "the inserts went missing" << std::endl;
+    return rate;
+}
+
+int main(int argc, char** argv)
+{
+    auto rows = bench::arg(argc, argv, 1, 200000);
+    auto max_writers = bench::arg(argc, argv, 2, 32);
+    auto shards = bench::arg(argc, argv, 3, 16);
+
+    auto txs = bench::make_txs(rows);
+
+    std::cout << rows << " inserts, " << shards << " shards, " <<
+        bench::hardware_threads() << " hardware threads:" << std::endl;
+    std::cout << "writers\ttx_db/s\t\tsharded/s\tspeedup" << std::endl;
+    for (auto writers: bench::thread_counts(max_writers))
+    {
+        libwallet::tx_db plain;
+        auto plain_rate = run_writers(plain, txs, writers);
+
+        libwallet::tx_sharded_db sharded(shards);
+        auto sharded_rate = run_writers(sharded, txs, writers);
+
+        std::cout << writers << '\t' << bench::rate(plain_rate, 1) <<
+            "\t\t" << bench::rate(sharded_rate, 1) << "\t\t" <<
+            std::setprecision(2) << sharded_rate / plain_rate << std::endl;
+    }
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <unistd.h>
 #include <zmq.hpp>
 #include <bitcoin/watcher.hpp>
 #include "read_line.hpp"
@@ -90,6 +91,7 @@ cli::~cli()
 cli::cli()
   : terminal_(context_),
     connection_(nullptr),
+    db_(24*60*60, true),
     done_(false)
 {
 }
@@ -230,11 +232,16 @@ void cli::cmd_tx_dump(std::stringstream& args)
     bc::hash_digest txid = read_txid(args);
     if (txid == bc::null_hash)
         return;
-    bc::transaction_type tx = db_.get_tx(txid);
+    auto tx = db_.get_tx_ptr(txid);
+    if (!tx)
+    {
+        std::cout << "transaction not in database" << std::endl;
+        return;
+    }
 
     std::basic_ostringstream<uint8_t> stream;
     auto serial = bc::make_serializer(std::ostreambuf_iterator<uint8_t>(stream));
-    serial.set_iterator(satoshi_save(tx, serial.iterator()));
+    serial.set_iterator(satoshi_save(*tx, serial.iterator()));
     auto str = stream.str();
     std::cout << bc::encode_hex(str) << std::endl;
 }
@@ -280,11 +287,13 @@ void cli::cmd_watch(std::stringstream& args)
 
 void cli::cmd_utxos(std::stringstream& args)
 {
+    // Query a single snapshot, so the results stay consistent:
+    auto snapshot = db_.snapshot();
     bc::output_info_list utxos;
     if (connection_)
-        utxos = db_.get_utxos(connection_->updater_.watching());
+        utxos = snapshot.get_utxos(connection_->updater_.watching());
     else
-        utxos = db_.get_utxos();
+        utxos = snapshot.get_utxos();
 
     // Display the output:
     size_t total = 0;
@@ -292,8 +301,8 @@ void cli::cmd_utxos(std::stringstream& args)
     {
         std::cout << bc::encode_hex(utxo.point.hash) << ":" <<
             utxo.point.index << std::endl;
-        auto tx = db_.get_tx(utxo.point.hash);
-        auto& output = tx.outputs[utxo.point.index];
+        auto tx = snapshot.get_tx(utxo.point.hash);
+        auto& output = tx->outputs[utxo.point.index];
         bc::payment_address to_address;
         if (bc::extract(to_address, output.script))
             std::cout << "address: " << to_address.encoded() << " ";
@@ -309,16 +318,36 @@ void cli::cmd_save(std::stringstream& args)
     if (!read_string(args, filename, "no filename given"))
         return;
 
-    std::ofstream file(filename);
-    if (!file.is_open())
-    {
-        std::cerr << "cannot open " << filename << std::endl;
-        return;
-    }
+    libwallet::tx_checkpoint checkpoint(db_, filename);
+    if (!checkpoint.save())
+        std::cerr << "error while saving data" << std::endl;
+}
 
-    auto db = db_.serialize();
-    file.write(reinterpret_cast<const char*>(db.data()), db.size());
-    file.close();
+/**
+ * Returns the process's resident set size in bytes, or 0 if unknown.
+ */
+static size_t resident_bytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t total = 0, resident = 0;
+    if (!(statm >> total >> resident))
+        return 0;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void print_memory(const char* label, libwallet::tx_db& db)
+{
+    auto arenas = db.arena_usage();
+    std::cout << label << ": rss " << resident_bytes() / 1024 << "k, " <<
+        arenas.arenas << " arenas in " << arenas.slabs << " slabs, " <<
+        arenas.used / 1024 << "k used of " <<
+        arenas.reserved / 1024 << "k reserved" << std::endl;
+
+    auto scripts = db.script_usage();
+    std::cout << label << ": " << scripts.scripts << " scripts shared by " <<
+        scripts.references << " outputs, " <<
+        scripts.saved_bytes() / 1024 << "k saved after " <<
+        scripts.overhead_bytes / 1024 << "k overhead" << std::endl;
 }
 
 void cli::cmd_load(std::stringstream& args)
@@ -327,21 +356,17 @@ void cli::cmd_load(std::stringstream& args)
     if (!read_string(args, filename, "no filename given"))
         return;
 
-    std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
-    if (!file.is_open())
+    print_memory("before", db_);
+    libwallet::tx_checkpoint checkpoint(db_, filename);
+    if (!checkpoint.load())
+        std::cerr << "error while loading " << filename << std::endl;
+    else if (!checkpoint.generation())
     {
-        std::cerr << "cannot open " << filename << std::endl;
-        return;
+        // No checkpoints, so this might be a plain database file:
+        if (!db_.load_file(filename))
+            std::cerr << "error while loading " << filename << std::endl;
     }
-
-    std::streampos size = file.tellg();
-    uint8_t *data = new uint8_t[size];
-    file.seekg(0, std::ios::beg);
-    file.read(reinterpret_cast<char*>(data), size);
-    file.close();
-
-    if (!db_.load(bc::data_chunk(data, data + size)))
-        std::cerr << "error while loading data" << std::endl;
+    print_memory("after", db_);
 }
 
 void cli::cmd_dump(std::stringstream& args)
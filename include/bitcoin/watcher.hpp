@@ -31,7 +31,13 @@
 
 // Convenience header that includes everything
 // Not to be used internally. For API users.
+#include <bitcoin/watcher/script_pool.hpp>
+#include <bitcoin/watcher/tx_arena.hpp>
+#include <bitcoin/watcher/tx_autosave.hpp>
+#include <bitcoin/watcher/tx_checkpoint.hpp>
 #include <bitcoin/watcher/tx_db.hpp>
+#include <bitcoin/watcher/tx_journal.hpp>
+#include <bitcoin/watcher/tx_sharded_db.hpp>
 #include <bitcoin/watcher/tx_updater.hpp>
 
 #endif
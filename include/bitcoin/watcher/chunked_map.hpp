@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBBITCOIN_WATCHER_CHUNKED_MAP_HPP
+#define LIBBITCOIN_WATCHER_CHUNKED_MAP_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+namespace libwallet {
+
+/**
+ * A map split into a fixed number of chunks, which copies share until
+ * one side writes to them.
+ *
+ * Copying the map only copies a pointer per chunk, no matter how many
+ * entries there are. The first write to a chunk that a copy still holds
+ * clones just that chunk. This lets a database hand out snapshots of
+ * its tables cheaply, and then keep changing the tables underneath.
+ *
+ * Lookups and iteration only come in const forms, so reading a shared
+ * map never clones anything. Changing an entry in place goes through
+ * modify(), which clones the entry's chunk first if need be.
+ *
+ * Writes must not race with copies of the same map, since cloning
+ * relies on the chunk's use count. Dropping a copy from another thread
+ * is fine, though.
+ *
+ * @param Map the map type each chunk holds.
+ * @param Chunker picks a chunk, less than chunk_count, for a key.
+ * The keys need to spread evenly for the chunks to stay small.
+ */
+template <typename Map, typename Chunker>
+class chunked_map
+{
+public:
+    typedef typename Map::key_type key_type;
+    typedef typename Map::mapped_type mapped_type;
+    typedef typename Map::value_type value_type;
+    static constexpr size_t chunk_count = 256;
+
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename Map::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator()
+          : map_(nullptr), chunk_(chunk_count)
+        {
+        }
+
+        reference operator*() const
+        {
+            return *inner_;
+        }
+        pointer operator->() const
+        {
+            return &*inner_;
+        }
+
+        const_iterator& operator++()
+        {
+            ++inner_;
+            if (inner_ == map_->chunks_[chunk_]->end())
+                next_chunk(chunk_ + 1);
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            auto out = *this;
+            ++*this;
+            return out;
+        }
+
+        bool operator==(const const_iterator& other) const
+        {
+            return chunk_ == other.chunk_ &&
+                (chunk_count == chunk_ || inner_ == other.inner_);
+        }
+        bool operator!=(const const_iterator& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        friend class chunked_map;
+        typedef typename Map::const_iterator inner_iterator;
+
+        const_iterator(const chunked_map* map, size_t chunk,
+            inner_iterator inner)
+          : map_(map), chunk_(chunk), inner_(inner)
+        {
+        }
+
+        /**
+         * Moves to the first entry in the first non-empty chunk
+         * starting from `chunk`, or to the end.
+         */
+        void next_chunk(size_t chunk)
+        {
+            for (chunk_ = chunk; chunk_ < chunk_count; ++chunk_)
+            {
+                const auto& part = map_->chunks_[chunk_];
+                if (part && !part->empty())
+                {
+                    inner_ = part->begin();
+                    return;
+                }
+            }
+        }
+
+        const chunked_map* map_;
+        size_t chunk_;
+        inner_iterator inner_;
+    };
+    typedef const_iterator iterator;
+
+    chunked_map()
+      : size_(0)
+    {
+    }
+
+    const_iterator begin() const
+    {
+        const_iterator out(this, 0, typename Map::const_iterator());
+        out.next_chunk(0);
+        return out;
+    }
+    const_iterator end() const
+    {
+        return const_iterator(this, chunk_count,
+            typename Map::const_iterator());
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return !size_;
+    }
+
+    void clear()
+    {
+        for (auto& chunk: chunks_)
+            chunk.reset();
+        size_ = 0;
+    }
+
+    void swap(chunked_map& other)
+    {
+        chunks_.swap(other.chunks_);
+        std::swap(size_, other.size_);
+    }
+
+    /**
+     * Makes room for at least `count` entries, spread over the chunks.
+     * This clones any shared chunks, so only use it on fresh maps.
+     */
+    void reserve(size_t count)
+    {
+        for (size_t i = 0; i < chunk_count; ++i)
+            writable(i).reserve(count / chunk_count + 1);
+    }
+
+    const_iterator find(const key_type& key) const
+    {
+        auto i = Chunker()(key);
+        const auto& chunk = chunks_[i];
+        if (!chunk)
+            return end();
+        auto inner = chunk->find(key);
+        if (inner == chunk->end())
+            return end();
+        return const_iterator(this, i, inner);
+    }
+
+    size_t count(const key_type& key) const
+    {
+        return find(key) != end();
+    }
+
+    /**
+     * Returns the value for a key, ready to change in place,
+     * or null if the key is missing.
+     */
+    mapped_type* modify(const key_type& key)
+    {
+        auto i = Chunker()(key);
+        if (!chunks_[i] || !chunks_[i]->count(key))
+            return nullptr;
+        return &writable(i).find(key)->second;
+    }
+
+    /**
+     * Inserts an entry, unless one with the same key already exists.
+     * @return true if the entry was inserted.
+     */
+    bool insert(value_type&& value)
+    {
+        auto i = Chunker()(value.first);
+        if (chunks_[i] && chunks_[i]->count(value.first))
+            return false;
+        writable(i).insert(std::move(value));
+        ++size_;
+        return true;
+    }
+
+    mapped_type& operator[](const key_type& key)
+    {
+        auto& chunk = writable(Chunker()(key));
+        auto before = chunk.size();
+        auto& out = chunk[key];
+        size_ += chunk.size() - before;
+        return out;
+    }
+
+    size_t erase(const key_type& key)
+    {
+        auto i = Chunker()(key);
+        if (!chunks_[i] || !chunks_[i]->count(key))
+            return 0;
+        writable(i).erase(key);
+        --size_;
+        return 1;
+    }
+
+private:
+    /**
+     * Returns a chunk that nobody else holds, cloning it if need be.
+     */
+    Map& writable(size_t i)
+    {
+        auto& chunk = chunks_[i];
+        if (!chunk)
+            chunk = std::make_shared<Map>();
+        else if (1 < chunk.use_count())
+            chunk = std::make_shared<Map>(*chunk);
+        else
+        {
+            // The last other holder may have just let go on another
+            // thread, so make sure its reads finish before our writes:
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *chunk;
+    }
+
+    std::array<std::shared_ptr<Map>, chunk_count> chunks_;
+    size_t size_;
+};
+
+} // namespace libwallet
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBBITCOIN_WATCHER_DIGEST_MAP_HPP
+#define LIBBITCOIN_WATCHER_DIGEST_MAP_HPP
+
+#include <bitcoin/bitcoin.hpp>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace libwallet {
+
+/**
+ * A hash map keyed by bc::hash_digest, built for transaction hashes.
+ *
+ * The entries live in a dense vector, which makes iteration a linear
+ * scan, and avoids an allocation per entry. A separate open-addressing
+ * table, using Robin Hood probing, maps keys to positions in the vector.
+ *
+ * Transaction hashes are already uniformly random, so the first 8 bytes
+ * of the hash serve as the hash code. Each slot keeps a copy of those
+ * bytes, so probing rarely needs to touch the entries themselves.
+ * The full hash is still compared on a match, since 64 bits is not
+ * enough to rule out a deliberate collision.
+ *
+ * Erasing moves the last entry into the gap, so erasing or inserting
+ * invalidates iterators and pointers into the map. erase() returns an
+ * iterator to the entry that moved into the erased position, so the
+ * usual erase-while-iterating loop still visits every entry.
+ */
+template <typename T>
+class digest_map
+{
+public:
+    typedef bc::hash_digest key_type;
+    typedef T mapped_type;
+    typedef std::pair<bc::hash_digest, T> value_type;
+    typedef typename std::vector<value_type>::iterator iterator;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+    digest_map()
+      : mask_(0), size_limit_(0)
+    {
+    }
+
+    iterator begin()
+    {
+        return entries_.begin();
+    }
+    iterator end()
+    {
+        return entries_.end();
+    }
+    const_iterator begin() const
+    {
+        return entries_.begin();
+    }
+    const_iterator end() const
+    {
+        return entries_.end();
+    }
+
+    size_t size() const
+    {
+        return entries_.size();
+    }
+    bool empty() const
+    {
+        return entries_.empty();
+    }
+
+    void clear()
+    {
+        entries_.clear();
+        slots_.clear();
+        mask_ = 0;
+        size_limit_ = 0;
+    }
+
+    void swap(digest_map& other)
+    {
+        entries_.swap(other.entries_);
+        slots_.swap(other.slots_);
+        std::swap(mask_, other.mask_);
+        std::swap(size_limit_, other.size_limit_);
+    }
+
+    /**
+     * Makes room for at least `count` entries without rehashing.
+     */
+    void reserve(size_t count)
+    {
+        entries_.reserve(count);
+        if (size_limit_ < count)
+            rehash(count);
+    }
+
+    iterator find(const bc::hash_digest& key)
+    {
+        auto i = find_slot(key);
+        if (no_slot == i)
+            return entries_.end();
+        return entries_.begin() + slots_[i].index;
+    }
+    const_iterator find(const bc::hash_digest& key) const
+    {
+        auto i = find_slot(key);
+        if (no_slot == i)
+            return entries_.end();
+        return entries_.begin() + slots_[i].index;
+    }
+
+    size_t count(const bc::hash_digest& key) const
+    {
+        return no_slot != find_slot(key);
+    }
+
+    /**
+     * Inserts an entry, unless one with the same key already exists.
+     * @return the entry with the key, and true if it was inserted.
+     */
+    std::pair<iterator, bool> insert(value_type&& value)
+    {
+        auto i = find_slot(value.first);
+        if (no_slot != i)
+            return std::make_pair(entries_.begin() + slots_[i].index, false);
+
+        if (size_limit_ <= entries_.size())
+            rehash(entries_.size() + 1);
+        auto index = static_cast<uint32_t>(entries_.size());
+        insert_slot(tag(value.first), index);
+        entries_.push_back(std::move(value));
+        return std::make_pair(entries_.begin() + index, true);
+    }
+    std::pair<iterator, bool> insert(const value_type& value)
+    {
+        return insert(value_type(value));
+    }
+    std::pair<iterator, bool> emplace(value_type&& value)
+    {
+        return insert(std::move(value));
+    }
+
+    T& operator[](const bc::hash_digest& key)
+    {
+        auto i = find(key);
+        if (i != entries_.end())
+            return i->second;
+        return insert(value_type(key, T())).first->second;
+    }
+
+    /**
+     * Removes an entry, moving the last entry into its place.
+     * @return an iterator to the entry now in the erased position.
+     */
+    iterator erase(const_iterator position)
+    {
+        auto index = static_cast<uint32_t>(position - entries_.begin());
+        erase_slot(slot_of(position->first, index));
+
+        // Fill the gap with the last entry:
+        auto last = static_cast<uint32_t>(entries_.size() - 1);
+        if (index != last)
+        {
+            slots_[slot_of(entries_[last].first, last)].index = index;
+            entries_[index] = std::move(entries_[last]);
+        }
+        entries_.pop_back();
+        return entries_.begin() + index;
+    }
+
+    size_t erase(const bc::hash_digest& key)
+    {
+        auto i = find(key);
+        if (i == entries_.end())
+            return 0;
+        erase(i);
+        return 1;
+    }
+
+private:
+    /**
+     * A slot in the probing table. `probe` is one more than the slot's
+     * distance from its ideal position, or zero if the slot is empty.
+     */
+    struct slot
+    {
+        uint64_t tag;
+        uint32_t index;
+        uint32_t probe;
+    };
+    static constexpr size_t no_slot = ~size_t(0);
+
+    static uint64_t tag(const bc::hash_digest& key)
+    {
+        uint64_t out;
+        std::memcpy(&out, key.data(), sizeof(out));
+        return out;
+    }
+
+    /**
+     * Picks a starting slot from the high bits of a multiplicative hash,
+     * in case the keys are less random than transaction hashes.
+     */
+    size_t home(uint64_t tag) const
+    {
+        return (tag * 0x9e3779b97f4a7c15ull) >> 32 & mask_;
+    }
+
+    size_t find_slot(const bc::hash_digest& key) const
+    {
+        if (slots_.empty())
+            return no_slot;
+        auto key_tag = tag(key);
+        auto i = home(key_tag);
+        for (uint32_t probe = 1; ; ++probe, i = (i + 1) & mask_)
+        {
+            const auto& s = slots_[i];
+
+            // Robin Hood ordering means the key would have been here:
+            if (s.probe < probe)
+                return no_slot;
+            if (s.tag == key_tag && entries_[s.index].first == key)
+                return i;
+        }
+    }
+
+    /**
+     * Finds the slot pointing at a particular entry.
+     */
+    size_t slot_of(const bc::hash_digest& key, uint32_t index) const
+    {
+        auto i = home(tag(key));
+        while (slots_[i].index != index || !slots_[i].probe)
+            i = (i + 1) & mask_;
+        return i;
+    }
+
+    /**
+     * Places a new slot, displacing any richer slots along the way.
+     */
+    void insert_slot(uint64_t key_tag, uint32_t index)
+    {
+        slot incoming{key_tag, index, 1};
+        auto i = home(key_tag);
+        while (true)
+        {
+            auto& s = slots_[i];
+            if (!s.probe)
+            {
+                s = incoming;
+                return;
+            }
+            if (s.probe < incoming.probe)
+                std::swap(s, incoming);
+            ++incoming.probe;
+            i = (i + 1) & mask_;
+        }
+    }
+
+    /**
+     * Empties a slot, shifting the following slots back to close the gap,
+     * so lookups never need tombstones.
+     */
+    void erase_slot(size_t i)
+    {
+        while (true)
+        {
+            auto next = (i + 1) & mask_;
+            if (slots_[next].probe <= 1)
+            {
+                slots_[i].probe = 0;
+                return;
+            }
+            slots_[i] = slots_[next];
+            --slots_[i].probe;
+            i = next;
+        }
+    }
+
+    /**
+     * Grows the probing table to hold at least `count` entries,
+     * staying at most 7/8 full.
+     */
+    void rehash(size_t count)
+    {
+        size_t capacity = 16;
+        while (capacity / 8 * 7 < count)
+            capacity *= 2;
+
+        slots_.assign(capacity, slot{0, 0, 0});
+        mask_ = capacity - 1;
+        size_limit_ = capacity / 8 * 7;
+        for (uint32_t i = 0; i < entries_.size(); ++i)
+            insert_slot(tag(entries_[i].first), i);
+    }
+
+    std::vector<value_type> entries_;
+    std::vector<slot> slots_;
+    size_t mask_;
+    size_t size_limit_;
+};
+
+} // namespace libwallet
+
+#endif
+
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBBITCOIN_WATCHER_SCRIPT_POOL_HPP
+#define LIBBITCOIN_WATCHER_SCRIPT_POOL_HPP
+
+#include <bitcoin/bitcoin.hpp>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace libwallet {
+
+/**
+ * How much sharing a script_pool is doing. The dedup ratio is
+ * `references / scripts`, and the net saving is
+ * `referenced_bytes - bytes - overhead_bytes`, which goes negative
+ * when most scripts are unique.
+ */
+struct script_pool_stats
+{
+    // Distinct scripts in the pool, and the outputs using them:
+    size_t scripts;
+    size_t references;
+
+    // Bytes the pooled scripts take up, and the bytes they would
+    // take up if every output kept its own copy:
+    size_t bytes;
+    size_t referenced_bytes;
+
+    // What pooling costs on top of the scripts themselves: each entry's
+    // header and hash table node, the table's buckets, and the pointer
+    // each output keeps to its entry. The node size is an estimate:
+    size_t overhead_bytes;
+
+    /**
+     * Returns the bytes pooling saves, net of its overhead.
+     */
+    ptrdiff_t saved_bytes() const
+    {
+        return ptrdiff_t(referenced_bytes) - ptrdiff_t(bytes) -
+            ptrdiff_t(overhead_bytes);
+    }
+};
+
+/**
+ * A reference-counted pool of output scripts.
+ *
+ * A wallet's outputs mostly pay the same handful of scripts, namely its
+ * own addresses, so storing each distinct script once saves a copy per
+ * output. The pool is split into shards with their own locks, so loading
+ * threads rarely wait on each other.
+ */
+class BC_API script_pool
+{
+public:
+    /**
+     * A pooled script. The script bytes follow the header in memory.
+     */
+    struct entry
+    {
+        uint64_t hash;
+        uint32_t size;
+        uint32_t references;
+
+        const uint8_t* data() const
+        {
+            return reinterpret_cast<const uint8_t*>(this + 1);
+        }
+    };
+
+    BC_API ~script_pool();
+    BC_API script_pool();
+    script_pool(const script_pool&) = delete;
+    script_pool& operator=(const script_pool&) = delete;
+
+    /**
+     * Returns the pooled copy of a script, adding it if needed,
+     * and takes a reference to it.
+     */
+    BC_API const entry* intern(const uint8_t* begin, const uint8_t* end);
+
+    /**
+     * Drops a reference, freeing the script once nothing uses it.
+     */
+    BC_API void release(const entry* script);
+
+    BC_API script_pool_stats stats();
+
+private:
+    struct shard
+    {
+        std::mutex mutex;
+        std::unordered_multimap<uint64_t, entry*> entries;
+        script_pool_stats stats;
+    };
+    static constexpr size_t shard_count = 16;
+
+    shard shards_[shard_count];
+};
+
+typedef std::shared_ptr<script_pool> script_pool_ptr;
+
+} // namespace libwallet
+
+#endif
+
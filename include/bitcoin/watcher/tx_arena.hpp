@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBBITCOIN_WATCHER_TX_ARENA_HPP
+#define LIBBITCOIN_WATCHER_TX_ARENA_HPP
+
+#include <bitcoin/bitcoin.hpp>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace libwallet {
+
+/**
+ * A bump allocator that hands out memory from large slabs.
+ *
+ * Individual allocations are never freed. Instead, all the slabs go
+ * away at once when the arena is destroyed. This suits data that is
+ * loaded together and discarded together, such as the rows that come
+ * from one file. Not thread-safe, so each loading thread gets its own.
+ */
+class BC_API tx_arena
+{
+public:
+    BC_API ~tx_arena();
+    BC_API tx_arena(size_t slab_size=1024*1024);
+    tx_arena(const tx_arena&) = delete;
+    tx_arena& operator=(const tx_arena&) = delete;
+
+    BC_API void* allocate(size_t size, size_t alignment);
+
+    /**
+     * Returns the total size of all slabs.
+     */
+    BC_API size_t reserved() const;
+
+    /**
+     * Returns the number of bytes handed out, not counting padding.
+     */
+    BC_API size_t used() const;
+
+    BC_API size_t slabs() const;
+
+private:
+    const size_t slab_size_;
+    std::vector<uint8_t*> slabs_;
+    uint8_t* next_;
+    uint8_t* end_;
+    size_t reserved_;
+    size_t used_;
+};
+
+typedef std::shared_ptr<tx_arena> tx_arena_ptr;
+
+/**
+ * Memory use across a group of arenas. The gap between `reserved` and
+ * `used` is the space lost to padding and partly-filled slabs.
+ */
+struct arena_stats
+{
+    size_t arenas;
+    size_t slabs;
+    size_t reserved;
+    size_t used;
+};
+
+/**
+ * An allocator for standard containers that draws from a tx_arena,
+ * or from the normal heap if it has no arena.
+ */
+template <typename T>
+class arena_allocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    arena_allocator(tx_arena* arena=nullptr)
+      : arena_(arena)
+    {
+    }
+
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& other)
+      : arena_(other.arena())
+    {
+    }
+
+    T* allocate(size_t count)
+    {
+        if (!arena_)
+            return static_cast<T*>(::operator new(count * sizeof(T)));
+        return static_cast<T*>(
+            arena_->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* data, size_t)
+    {
+        if (!arena_)
+            ::operator delete(data);
+    }
+
+    tx_arena* arena() const
+    {
+        return arena_;
+    }
+
+private:
+    tx_arena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b)
+{
+    return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b)
+{
+    return a.arena() != b.arena();
+}
+
+template <typename T>
+using arena_vector = std::vector<T, arena_allocator<T>>;
+
+typedef arena_vector<uint8_t> arena_chunk;
+
+} // namespace libwallet
+
+#endif
+
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBBITCOIN_WATCHER_TX_AUTOSAVE_HPP
+#define LIBBITCOIN_WATCHER_TX_AUTOSAVE_HPP
+
+#include <bitcoin/watcher/tx_db.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace libwallet {
+
+/**
+ * Timing and size information for a single save.
+ */
+struct BC_API autosave_stats
+{
+    // Time spent holding the database lock to capture a snapshot.
+    // This is the only part of a save that the rest of the program
+    // can ever wait on:
+    std::chrono::microseconds snapshot_time;
+
+    // Time spent encoding the snapshot, and handing it to the file:
+    std::chrono::microseconds encode_time;
+    std::chrono::microseconds write_time;
+
+    // Time spent flushing the file to disk and renaming it into place:
+    std::chrono::microseconds commit_time;
+
+    // Size of the saved file, and the number of changes it captured:
+    uint64_t bytes;
+    uint64_t changes;
+
+    // True if this was a full save, or false if it was only a patch.
+    // Patches are encoded while holding the lock, since they are small,
+    // so their encoding time shows up under snapshot_time:
+    bool full;
+};
+
+/**
+ * Periodically saves a tx_db to disk on a background thread.
+ *
+ * A full save captures a snapshot of the database, which only takes a
+ * shared lock for as long as it takes to copy the row table. The
+ * encoding and disk writes then happen without any lock held, so the
+ * updater and other queries carry on normally while a save is underway.
+ *
+ * Once a full save exists, later saves only write a patch holding the
+ * rows that changed since then, to path + ".patch". Each patch replaces
+ * the previous one, and once the patch grows past a fraction of the
+ * full file, the next save merges everything into a new full file.
+ * This keeps the cost of a save proportional to the amount of churn,
+ * rather than to the size of the database.
+ *
+ * Both files are replaced atomically, so a crash mid-save leaves the
+ * previous versions intact. Each patch records a checksum of the full
+ * file it applies to, so a patch left over from before a merge
+ * is ignored.
+ *
+ * Don't point this at the same path as a tx_journal,
+ * since the journal manages its own snapshot file.
+ */
+class BC_API tx_autosave
+{
+public:
+    BC_API ~tx_autosave();
+
+    /**
+     * @param interval the number of seconds between checks for changes.
+     * @param dirty_threshold the number of changes that must accumulate
+     * before a check actually saves.
+     * @param merge_ratio a patch larger than 1/merge_ratio of the full
+     * file triggers a merge into a new full file.
+     */
+    BC_API tx_autosave(tx_db& db, const std::string& path,
+        unsigned interval=60, uint64_t dirty_threshold=1,
+        unsigned merge_ratio=4);
+
+    /**
+     * Loads the database from the full file and patch on disk.
+     * A missing file is not an error, and neither is a patch that
+     * doesn't go with the full file, which gets discarded.
+     * @return false if the full file exists but cannot be read.
+     */
+    BC_API bool load();
+
+    /**
+     * Begins saving in the background.
+     */
+    BC_API void start();
+
+    /**
+     * Stops the background thread, waiting for any save in progress.
+     * If anything has changed since the last save, this saves one final
+     * time, regardless of the dirty threshold.
+     * @return false if the final save failed.
+     */
+    BC_API bool stop();
+
+    /**
+     * Saves right now, on the calling thread, if anything has changed.
+     * @return false if the save failed.
+     */
+    BC_API bool save();
+
+    /**
+     * Returns the statistics for the most recent successful save.
+     */
+    BC_API autosave_stats last_stats();
+
+    /**
+     * Returns false if the most recent save failed.
+     */
+    BC_API bool good();
+
+private:
+    bool save_changes(uint64_t threshold);
+    bool save_full(autosave_stats& stats, uint64_t& until);
+    bool save_patch(autosave_stats& stats, uint64_t& until, bool& need_full);
+    void run();
+
+    tx_db& db_;
+    const std::string path_;
+    const std::string patch_path_;
+    const std::chrono::seconds interval_;
+    const uint64_t dirty_threshold_;
+    const unsigned merge_ratio_;
+
+    // Serializes saves, so the background thread and explicit calls
+    // to save() never write the files at the same time.
+    // Everything up to the next mutex is guarded by this:
+    std::mutex save_mutex_;
+    uint64_t saved_changes_;
+
+    // The full file that patches are relative to:
+    bool has_base_;
+    uint32_t base_tag_;
+    uint64_t base_sequence_;
+    uint64_t base_bytes_;
+
+    // Guards everything below:
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool stopping_;
+    bool failed_;
+    autosave_stats stats_;
+
+    std::thread thread_;
+};
+
+} // namespace libwallet
+
+#endif
+
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBBITCOIN_WATCHER_TX_CHECKPOINT_HPP
+#define LIBBITCOIN_WATCHER_TX_CHECKPOINT_HPP
+
+#include <bitcoin/watcher/tx_db.hpp>
+#include <string>
+#include <vector>
+
+namespace libwallet {
+
+/**
+ * Saves a tx_db as a series of numbered checkpoint generations,
+ * keeping the last few around in case the newest one is damaged.
+ *
+ * Generation n lives in path + "." + (n % generations). Each file wraps
+ * the normal serialized database in a header and footer that both carry
+ * the generation number, along with checksums. Loading picks the newest
+ * generation whose header, footer, and record checksums all check out.
+ * The header and footer get checked before reading anything else, and
+ * the record checksums get checked once, while the records load.
+ */
+class BC_API tx_checkpoint
+{
+public:
+    /**
+     * @param generations the number of checkpoint files to rotate through.
+     */
+    BC_API tx_checkpoint(tx_db& db, const std::string& path,
+        unsigned generations=3);
+
+    /**
+     * Writes the database out as the next generation, replacing the
+     * oldest one. The write goes through a temporary file,
+     * so even that generation survives a crash mid-save.
+     */
+    BC_API bool save();
+
+    /**
+     * Loads the newest intact generation.
+     * @return false if checkpoints exist, but none of them are intact.
+     */
+    BC_API bool load(unsigned threads=0);
+
+    /**
+     * Returns the newest generation known to be on disk,
+     * or 0 if there are none.
+     */
+    BC_API uint64_t generation();
+
+private:
+    struct candidate
+    {
+        uint64_t generation;
+        std::string path;
+    };
+    std::vector<candidate> scan();
+    std::string slot_path(uint64_t generation);
+
+    tx_db& db_;
+    const std::string path_;
+    const unsigned generations_;
+
+    bool scanned_;
+    uint64_t generation_;
+};
+
+} // namespace libwallet
+
+#endif
+
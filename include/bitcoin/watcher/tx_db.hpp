@@ -20,8 +20,16 @@
 #define LIBBITCOIN_WATCHER_TX_DB_HPP
 
 #include <bitcoin/bitcoin.hpp>
+#include <bitcoin/watcher/chunked_map.hpp>
+#include <bitcoin/watcher/digest_map.hpp>
+#include <bitcoin/watcher/script_pool.hpp>
+#include <bitcoin/watcher/tx_arena.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <ostream>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <time.h>
@@ -39,6 +47,75 @@ enum class tx_state
 };
 
 typedef std::unordered_set<bc::payment_address> address_set;
+typedef std::vector<bc::output_point> output_point_list;
+typedef std::vector<bc::payment_address> address_list;
+typedef std::shared_ptr<const bc::transaction_type> tx_ptr;
+typedef std::vector<tx_ptr> tx_ptr_list;
+typedef std::vector<bc::hash_digest> hash_list;
+
+class tx_snapshot;
+class tx_journal;
+class tx_autosave;
+class tx_checkpoint;
+class tx_sharded_db;
+class tx_updater;
+
+/**
+ * The parts of a transaction database that the updater works with,
+ * so one updater can keep either a tx_db or a tx_sharded_db in sync.
+ */
+class BC_API tx_store
+{
+public:
+    virtual ~tx_store() {};
+
+    typedef std::pair<bc::transaction_type, tx_state> tx_entry;
+    typedef std::vector<tx_entry> tx_entry_list;
+    typedef std::function<void (const bc::transaction_type& tx)> tx_fn;
+    typedef std::function<void (bc::hash_digest tx_hash)> hash_fn;
+
+    /**
+     * Returns the highest block that this database has seen.
+     */
+    virtual size_t last_height() = 0;
+
+    /**
+     * Returns true if the database contains a transaction.
+     */
+    virtual bool has_tx(bc::hash_digest tx_hash) = 0;
+
+    /**
+     * Obtains a read-only pointer to a transaction in the database,
+     * or nullptr if it is missing.
+     */
+    virtual tx_ptr get_tx_ptr(bc::hash_digest tx_hash) = 0;
+
+    /**
+     * Insert a new transaction into the database.
+     * @return true if the callback should be fired.
+     */
+    virtual bool insert(const bc::transaction_type& tx, tx_state state) = 0;
+
+    /**
+     * Insert several transactions at once.
+     * @return a flag for each entry, which is true if the entry was new
+     * and its callback should be fired.
+     */
+    virtual std::vector<bool> insert_batch(const tx_entry_list& entries) = 0;
+
+private:
+    // - Updater: ----------------------
+    friend class tx_updater;
+
+    virtual void at_height(size_t height) = 0;
+    virtual void confirmed(bc::hash_digest tx_hash, size_t block_height) = 0;
+    virtual void unconfirmed(bc::hash_digest tx_hash) = 0;
+    virtual void forget(bc::hash_digest tx_hash) = 0;
+    virtual void reset_timestamp(bc::hash_digest tx_hash) = 0;
+    virtual void foreach_unconfirmed(hash_fn&& f) = 0;
+    virtual void foreach_forked(hash_fn&& f) = 0;
+    virtual void foreach_unsent(tx_fn&& f) = 0;
+};
 
 /**
  * A list of transactions.
@@ -51,26 +128,62 @@ typedef std::unordered_set<bc::payment_address> address_set;
  * provide the necessary information.
  */
 class BC_API tx_db
+  : public tx_store
 {
 public:
     BC_API ~tx_db();
-    BC_API tx_db(unsigned unconfirmed_timeout=24*60*60);
+    /**
+     * @param use_arenas store the rows from each load in a few large
+     * arenas, which go away all at once when a later load replaces them.
+     * This cuts heap fragmentation for databases that get reloaded.
+     */
+    BC_API tx_db(unsigned unconfirmed_timeout=24*60*60,
+        bool use_arenas=false);
 
     /**
      * Returns the highest block that this database has seen.
      */
-    BC_API size_t last_height();
+    BC_API virtual size_t last_height() override;
 
     /**
      * Returns true if the database contains a transaction.
      */
-    BC_API bool has_tx(bc::hash_digest tx_hash);
+    BC_API virtual bool has_tx(bc::hash_digest tx_hash) override;
 
     /**
      * Obtains a transaction from the database.
      */
     BC_API bc::transaction_type get_tx(bc::hash_digest tx_hash);
 
+    /**
+     * Obtains a read-only pointer to a transaction in the database,
+     * or nullptr if it is missing. Unlike get_tx, this does not copy the
+     * transaction, and the pointer stays valid even if the transaction
+     * is later removed from the database.
+     */
+    BC_API virtual tx_ptr get_tx_ptr(bc::hash_digest tx_hash) override;
+
+    /**
+     * Looks up several transactions at once, taking the lock only once.
+     * @return a pointer for each hash, in the same order,
+     * which is nullptr if the transaction is missing.
+     */
+    BC_API tx_ptr_list get_txs(const hash_list& tx_hashes);
+
+    /**
+     * Finds several transactions' heights at once, taking the lock only
+     * once. Each height is 0 if the transaction isn't in a block.
+     */
+    BC_API std::vector<size_t> get_heights(const hash_list& tx_hashes);
+
+    /**
+     * Calls a function with a transaction from the database, without
+     * copying it. The database is locked for reading while the function
+     * runs, so it must not modify the database.
+     * @return false if the transaction is not in the database.
+     */
+    BC_API bool with_tx(bc::hash_digest tx_hash, const tx_fn& f);
+
     /**
      * Finds a transaction's height, or 0 if it isn't in a block.
      */
@@ -97,15 +210,95 @@ public:
      */
     BC_API bc::output_info_list get_utxos(const address_set& addresses);
 
+    /**
+     * Get every output in the database that pays to an address.
+     */
+    BC_API output_point_list get_history(const bc::payment_address& address);
+
+    /**
+     * Captures the current contents of the database.
+     * The tables are shared with the database, chunk by chunk, until
+     * the database changes them, so this takes constant time. Repeated
+     * calls return the same snapshot until the database changes.
+     */
+    BC_API tx_snapshot snapshot();
+
     /**
      * Write the database to an in-memory blob.
+     * @param threads the number of threads to encode with,
+     * or 0 to pick based on the hardware.
+     */
+    BC_API bc::data_chunk serialize(unsigned threads=0);
+
+    /**
+     * Receives serialized data in large chunks.
+     * @return false to abort the write.
      */
-    BC_API bc::data_chunk serialize();
+    typedef std::function<bool (const uint8_t* data, size_t size)> sink_fn;
+
+    /**
+     * Write the database out a chunk at a time, such as to a file,
+     * without ever building the whole blob in memory.
+     * Each encoding thread holds a few megabytes at a time.
+     * @param threads the number of threads to encode with,
+     * or 0 to pick based on the hardware.
+     * @return false if the sink aborted the write.
+     */
+    BC_API bool serialize_to(const sink_fn& sink, unsigned threads=0);
 
     /**
      * Reconstitute the database from an in-memory blob.
+     * @param threads the number of threads to decode with,
+     * or 0 to pick based on the hardware.
+     */
+    BC_API bool load(const bc::data_chunk& data, unsigned threads=0);
+
+    /**
+     * Reconstitute the database from a file on disk.
+     * The file is memory-mapped and parsed in place, so the raw data never
+     * needs to be copied into memory first.
+     * @param threads the number of threads to decode with,
+     * or 0 to pick based on the hardware.
+     */
+    BC_API bool load_file(const std::string& path, unsigned threads=0);
+
+    /**
+     * Returns a number that increases with every change to the database.
+     */
+    BC_API uint64_t sequence();
+
+    /**
+     * Returns the memory held by the arenas from past loads.
+     * This is all zeros unless the database was created with use_arenas.
+     */
+    BC_API arena_stats arena_usage();
+
+    /**
+     * Returns how much the shared output scripts are saving.
      */
-    BC_API bool load(const bc::data_chunk& data);
+    BC_API script_pool_stats script_usage();
+
+    /**
+     * Write out a patch holding only the rows that changed, or were
+     * forgotten, after the given sequence number. Loading the patch on
+     * top of a database saved at that point brings it up to date.
+     * The sink is called with the database lock held, so it should
+     * buffer the data rather than doing slow I/O.
+     * @param base_tag an identifier for the saved file the patch goes
+     * with, which load_patch checks.
+     * @param until receives the sequence number the patch is current to.
+     * @return false if the sink aborted the write, or if the database
+     * has been reloaded since `since`, so only a full save will do.
+     */
+    BC_API bool serialize_patch(uint64_t since, uint32_t base_tag,
+        const sink_fn& sink, uint64_t& until);
+
+    /**
+     * Apply a patch from serialize_patch on top of the current contents.
+     * @return false if the patch is damaged, or if its base tag
+     * doesn't match.
+     */
+    BC_API bool load_patch(const bc::data_chunk& data, uint32_t base_tag);
 
     /**
      * Debug dump to show db contents.
@@ -116,62 +309,287 @@ public:
      * Insert a new transaction into the database.
      * @return true if the callback should be fired.
      */
-    BC_API bool insert(const bc::transaction_type &tx, tx_state state);
+    BC_API virtual bool insert(const bc::transaction_type &tx,
+        tx_state state) override;
+
+    /**
+     * Insert several transactions at once, taking the lock only once.
+     * @return a flag for each entry, which is true if the entry was new
+     * and its callback should be fired.
+     */
+    BC_API virtual std::vector<bool> insert_batch(
+        const tx_entry_list& entries) override;
 
 private:
     // - Updater: ----------------------
-    friend class tx_updater;
+    friend class tx_snapshot;
+    friend class tx_journal;
+    friend class tx_autosave;
+    friend class tx_checkpoint;
+    friend class tx_sharded_db;
+
+    // Spent outputs, each with the transaction spending it:
+    typedef std::vector<std::pair<bc::output_point, bc::hash_digest>>
+        spend_list;
+
+    /**
+     * Lets several databases share one script pool.
+     * @param sharded makes this database one shard of a tx_sharded_db,
+     * whose spend index covers the spends of its own outputs, wherever
+     * the spending transactions live.
+     */
+    tx_db(unsigned unconfirmed_timeout, bool use_arenas,
+        script_pool_ptr scripts, bool sharded);
 
     /**
      * Updates the block height.
      */
-    void at_height(size_t height);
+    virtual void at_height(size_t height) override;
 
     /**
      * Mark a transaction as confirmed.
      * TODO: Require the block hash as well, once obelisk provides this.
      */
-    void confirmed(bc::hash_digest tx_hash, size_t block_height);
+    virtual void confirmed(bc::hash_digest tx_hash,
+        size_t block_height) override;
 
     /**
      * Mark a transaction as unconfirmed.
      */
-    void unconfirmed(bc::hash_digest tx_hash);
+    virtual void unconfirmed(bc::hash_digest tx_hash) override;
 
     /**
      * Delete a transaction.
      * This can happen when the network rejects a spend request.
      */
-    BC_API void forget(bc::hash_digest tx_hash);
+    BC_API virtual void forget(bc::hash_digest tx_hash) override;
+
+    /**
+     * Delete a transaction, adding the spends it made to `spends`.
+     */
+    void forget(bc::hash_digest tx_hash, spend_list& spends);
 
     /**
      * Call this each time the server reports that it sees a transaction.
      */
-    BC_API void reset_timestamp(bc::hash_digest tx_hash);
+    BC_API virtual void reset_timestamp(bc::hash_digest tx_hash) override;
 
-    typedef std::function<void (bc::hash_digest tx_hash)> hash_fn;
-    BC_API void foreach_unconfirmed(hash_fn&& f);
-    BC_API void foreach_forked(hash_fn&& f);
+    BC_API virtual void foreach_unconfirmed(hash_fn&& f) override;
+    BC_API virtual void foreach_forked(hash_fn&& f) override;
 
-    typedef std::function<void (const bc::transaction_type& tx)> tx_fn;
-    BC_API void foreach_unsent(tx_fn&& f);
+    BC_API virtual void foreach_unsent(tx_fn&& f) override;
+
+    /**
+     * Takes the lock and checks for a fork below the given height,
+     * for shards that hear about the fork from another shard.
+     */
+    void fork_check(size_t height);
 
     // - Internal: ---------------------
     void check_fork(size_t height);
-
-    // Guards access to object state:
-    std::mutex mutex_;
+    static size_t shard_index(const bc::hash_digest& tx_hash, size_t shards);
+    struct tx_data;
+    typedef std::shared_ptr<const tx_data> tx_data_ptr;
+    struct tx_row;
+    tx_data_ptr make_data(const bc::transaction_type& tx);
+    tx_data_ptr make_raw_data(const uint8_t* begin,
+        const uint8_t* end, const tx_arena_ptr& arena);
+    void insert_row(const bc::hash_digest& tx_hash, tx_data_ptr data,
+        tx_state state, time_t timestamp);
+    bool insert_hashed(const bc::hash_digest& tx_hash,
+        const bc::transaction_type& tx, tx_state state);
+    std::vector<bool> insert_hashed(const hash_list& hashes,
+        const std::vector<const tx_entry*>& entries);
+    /**
+     * Spreads transaction hashes over the chunks of a chunked_map.
+     * Byte 8 stays clear of the bytes that digest_map and the
+     * sharded database already use.
+     */
+    struct digest_chunk
+    {
+        size_t operator()(const bc::hash_digest& key) const
+        {
+            return key[8];
+        }
+    };
+    typedef chunked_map<digest_map<tx_row>, digest_chunk> row_map;
+    typedef std::vector<const row_map::value_type*> row_list;
+    typedef std::vector<std::pair<bc::hash_digest, tx_row>> row_vector;
+    bool load_data(const uint8_t* begin, const uint8_t* end,
+        unsigned threads);
+    static bool is_legacy_data(const uint8_t* begin, const uint8_t* end);
+    typedef std::vector<tx_arena_ptr> arena_list;
+    bool decode_data(const uint8_t* begin, const uint8_t* end,
+        unsigned threads, size_t& last_height, row_map& rows,
+        arena_list& arenas);
+    void replace_rows(size_t last_height, row_map& rows,
+        const arena_list& arenas, const spend_list* spends=nullptr);
+    bool load_v1(const uint8_t* begin, const uint8_t* end,
+        size_t& last_height, row_map& rows);
+    bool load_v2(const uint8_t* begin, const uint8_t* end,
+        size_t& last_height, row_map& rows, unsigned threads,
+        arena_list* arenas);
+    static bool check_v2(const uint8_t* begin, const uint8_t* end,
+        const uint8_t*& records_end, uint64_t& count);
+    bool load_records(const uint8_t* begin, const uint8_t* end,
+        row_vector& out, uint64_t& height, const tx_arena_ptr& arena,
+        hash_list* forgotten=nullptr);
+    static tx_row load_row(tx_data_ptr data, tx_state state,
+        uint64_t height, bool need_check, time_t now);
+    static row_list save_order(const row_map& rows,
+        unsigned unconfirmed_timeout, uint64_t first_sequence=0);
+    static void sort_order(row_list& order);
+    static uint64_t height_field(const tx_row& row, uint64_t& previous_height);
+    static size_t serialized_size(const row_list& order);
+    static bool write_rows(size_t last_height, const row_list& order,
+        const sink_fn& sink, unsigned threads);
+    static bool should_save(const tx_row& row, time_t now,
+        unsigned unconfirmed_timeout);
+    void changed();
+    void changed(tx_row& row);
+    void erase_row(row_map::const_iterator i);
+    void prune_forgotten(uint64_t sequence);
+    struct snapshot_data;
+    std::shared_ptr<const snapshot_data> snapshot_part();
+    tx_snapshot make_snapshot();
+    void dump_rows(std::ostream& out);
+    void set_timestamp(bc::hash_digest tx_hash, time_t timestamp);
+    void index_tx(const bc::hash_digest& tx_hash, const tx_row& row);
+    void unindex_tx(const bc::hash_digest& tx_hash, const tx_row& row);
+    void index_state(const bc::hash_digest& tx_hash, const tx_row& row);
+    void unindex_state(const bc::hash_digest& tx_hash, const tx_row& row);
+    void index_spend(const bc::output_point& point,
+        const bc::hash_digest& spender);
+    void unindex_spend(const bc::output_point& point,
+        const bc::hash_digest& spender);
+    void add_spends(const spend_list& spends);
+    void remove_spends(const spend_list& spends);
+    struct index_set;
+    static void build_indexes(const row_map& rows, index_set& out,
+        const spend_list* spends);
+
+    // Guards access to object state. Queries take a shared lock,
+    // so they can run in parallel with each other, while anything that
+    // modifies the database takes an exclusive lock:
+    typedef boost::shared_mutex mutex_type;
+    typedef boost::shared_lock<mutex_type> read_lock;
+    typedef std::lock_guard<mutex_type> write_lock;
+    mutex_type mutex_;
 
     // The last block seen on the network:
     size_t last_height_;
 
+    /**
+     * A view of one input inside a tx_data buffer.
+     */
+    struct input_view
+    {
+        bc::output_point previous_output() const;
+        bc::data_slice script() const;
+
+        /**
+         * Returns the address the input spends from, or an invalid
+         * address if the script is non-standard or a coinbase.
+         */
+        bc::payment_address address() const;
+
+        // The input's bytes run from here to the end of the transaction:
+        const uint8_t* begin;
+        const uint8_t* end;
+
+        // The input's address, worked out when the row was made:
+        const uint8_t* address_bytes;
+    };
+
+    /**
+     * A view of one output inside a tx_data buffer.
+     */
+    struct output_view
+    {
+        uint64_t value() const;
+        bc::data_slice script() const;
+
+        /**
+         * Returns the address the output pays to,
+         * or an invalid address if the script is non-standard.
+         */
+        bc::payment_address address() const;
+
+        const uint8_t* begin;
+        const uint8_t* end;
+
+        // The output's script, which lives in the script pool:
+        const script_pool::entry* pooled;
+
+        // The output's address, worked out when the row was made:
+        const uint8_t* address_bytes;
+    };
+
+    /**
+     * The parts of a row that never change once it enters the database.
+     * Rows hold these by pointer, so snapshots can share them.
+     *
+     * Most rows are never looked at after loading, so the transaction is
+     * kept in its serialized form, in a single buffer along with a table
+     * locating each input and output. Queries read the fields they need
+     * through the input and output views. The full transaction object
+     * only gets built on first access.
+     *
+     * Each input and output's address is worked out once, when the row
+     * is made, and kept in the table as a version byte and a 20-byte
+     * hash, so the address queries never have to parse a script.
+     *
+     * The output scripts are cut out of the buffer and kept in the
+     * database's script pool instead, so each distinct script is stored
+     * once no matter how many outputs pay to it.
+     */
+    struct tx_data
+    {
+        tx_data(tx_arena_ptr arena, script_pool_ptr pool);
+        ~tx_data();
+
+        /**
+         * Returns the decoded transaction, decoding it if needed.
+         * This is safe to call from several readers at once.
+         */
+        const bc::transaction_type& tx() const;
+
+        /**
+         * Writes out the serialized transaction, which takes
+         * raw_size bytes, and returns the end of what was written.
+         */
+        uint8_t* write_raw(uint8_t* out) const;
+        bc::data_chunk raw() const;
+
+        input_view input(size_t i) const;
+        output_view output(size_t i) const;
+
+        // The arena holding the buffer, if any. Each row keeps its arena
+        // alive, and this comes first so it is freed last:
+        tx_arena_ptr arena;
+        script_pool_ptr pool;
+
+        // The serialized transaction with the output scripts left out,
+        // followed by the 4-byte offset of each input, and then of each
+        // output, within it, then a pool entry pointer per output, and
+        // then the 21-byte address of each input, and then each output:
+        arena_chunk buffer;
+        uint32_t raw_size;
+        uint32_t stripped_size;
+        uint32_t input_count;
+        uint32_t output_count;
+
+        // The decoded transaction, once somebody asks for it:
+        mutable std::once_flag decoded;
+        mutable std::unique_ptr<bc::transaction_type> decoded_tx;
+    };
+
     /**
      * A single row in the transaction database.
      */
     struct tx_row
     {
-        // The transaction itself:
-        bc::transaction_type tx;
+        tx_data_ptr data;
 
         // State machine:
         tx_state state;
@@ -182,12 +600,165 @@ private:
         // The transaction is certainly in a block, but there is some
         // question whether or not that block is on the main chain:
         bool need_check;
+
+        // The value of changes_ when this row last changed:
+        uint64_t sequence;
+    };
+
+    // The rows, which snapshots share until we change them:
+    row_map rows_;
+
+    // Rows that have been forgotten, along with the value of changes_
+    // at the time, so patches can record their removal:
+    std::unordered_map<bc::hash_digest, uint64_t> forgotten_;
+
+    /**
+     * Allows bc::output_point to key the indexes below.
+     */
+    struct point_hash
+    {
+        size_t operator()(const bc::output_point& point) const;
     };
-    std::unordered_map<bc::hash_digest, tx_row> rows_;
+
+    // Every output spent by a transaction in the database, along with the
+    // transactions that spend it (there can be more than one if the
+    // network has seen a double-spend):
+    std::unordered_multimap<bc::output_point, bc::hash_digest, point_hash>
+        spends_;
+
+    // Every output that no transaction in the database spends,
+    // along with its value. Snapshots share this, like the rows:
+    struct point_chunk
+    {
+        size_t operator()(const bc::output_point& point) const
+        {
+            return point.hash[8];
+        }
+    };
+    typedef chunked_map<
+        std::unordered_map<bc::output_point, uint64_t, point_hash>,
+        point_chunk> utxo_map;
+    utxo_map utxos_;
+
+    // Every output with a standard script, grouped by receiving address:
+    std::unordered_multimap<bc::payment_address, bc::output_point>
+        addresses_;
+
+    // Confirmed transactions, grouped by block height:
+    std::map<size_t, std::unordered_set<bc::hash_digest>> heights_;
+
+    // Transactions partitioned by state, so the updater's foreach
+    // helpers only visit the handful of rows they care about:
+    std::unordered_set<bc::hash_digest> unsent_;
+    std::unordered_set<bc::hash_digest> unconfirmed_;
+    std::unordered_set<bc::hash_digest> forked_;
+
+    /**
+     * A full set of the indexes above, built from a freshly-loaded
+     * table outside the lock, and then swapped in along with it.
+     */
+    struct index_set
+    {
+        decltype(spends_) spends;
+        decltype(utxos_) utxos;
+        decltype(addresses_) addresses;
+        decltype(heights_) heights;
+        decltype(unsent_) unsent;
+        decltype(unconfirmed_) unconfirmed;
+        decltype(forked_) forked;
+    };
+
+    // The most recent snapshot, if anybody is still holding it.
+    // Any change to the database clears this:
+    std::weak_ptr<const snapshot_data> snapshot_;
+    std::mutex snapshot_mutex_;
+
+    // Receives a record of every change, if journaling is turned on:
+    tx_journal* journal_;
+
+    // Counts every change to the database, so savers can tell
+    // how much has happened since they last looked:
+    uint64_t changes_;
+
+    // The value of changes_ right after the last load,
+    // which no patch can reach back past:
+    uint64_t loaded_sequence_;
 
     // Number of seconds an unconfirmed transaction must remain unseen
     // before we stop saving it:
     const unsigned unconfirmed_timeout_;
+
+    // Whether loads put their rows in arenas, and the arenas from
+    // past loads, which live on until the last row using them goes away:
+    const bool use_arenas_;
+    std::vector<std::weak_ptr<const tx_arena>> arenas_;
+
+    // The output scripts of every row:
+    const script_pool_ptr scripts_;
+
+    // True if this is a shard of a tx_sharded_db, which routes
+    // each spend to the shard holding the spent output:
+    const bool sharded_;
+};
+
+/**
+ * An immutable, point-in-time view of a tx_db or tx_sharded_db.
+ *
+ * Snapshots are cheap to copy, and their queries never touch the
+ * database lock, so a caller can run many queries against one consistent
+ * version of the database while the updater keeps changing it.
+ */
+class BC_API tx_snapshot
+{
+public:
+    /**
+     * Returns the highest block that the database had seen.
+     */
+    BC_API size_t last_height() const;
+
+    /**
+     * Returns true if the snapshot contains a transaction.
+     */
+    BC_API bool has_tx(bc::hash_digest tx_hash) const;
+
+    /**
+     * Obtains a transaction from the snapshot, or nullptr if it is missing.
+     */
+    BC_API tx_ptr get_tx(bc::hash_digest tx_hash) const;
+
+    /**
+     * Finds a transaction's height, or 0 if it isn't in a block.
+     */
+    BC_API size_t get_tx_height(bc::hash_digest tx_hash) const;
+
+    /**
+     * Get all unspent outputs in the snapshot.
+     */
+    BC_API bc::output_info_list get_utxos() const;
+
+    /**
+     * Get just the utxos corresponding to a set of addresses.
+     */
+    BC_API bc::output_info_list get_utxos(const address_set& addresses) const;
+
+    /**
+     * Write the snapshot out in the same format as tx_db::serialize_to.
+     * This is safe to do on any thread, and doesn't block the database.
+     */
+    BC_API bool serialize_to(const tx_db::sink_fn& sink,
+        unsigned threads=0) const;
+
+private:
+    friend class tx_db;
+    friend class tx_sharded_db;
+    typedef std::vector<std::shared_ptr<const tx_db::snapshot_data>>
+        part_list;
+    tx_snapshot(part_list parts);
+    const tx_db::snapshot_data& part_for(const bc::hash_digest& tx_hash) const;
+
+    // One part per shard, or just the one for a plain tx_db.
+    // Each part holds its shard's transactions, and their utxos:
+    part_list parts_;
 };
 
 } // namespace libwallet
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBBITCOIN_WATCHER_TX_JOURNAL_HPP
+#define LIBBITCOIN_WATCHER_TX_JOURNAL_HPP
+
+#include <bitcoin/watcher/tx_db.hpp>
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace libwallet {
+
+/**
+ * Keeps a tx_db persisted on disk as a snapshot plus an append-only
+ * journal of the changes made since that snapshot.
+ *
+ * Each change to the database appends a small record to the journal, so
+ * saving costs time proportional to the number of changes, rather than
+ * to the size of the database. Once the journal grows large enough, a
+ * background thread folds it into a fresh snapshot.
+ *
+ * The snapshot lives at the given path, in the normal tx_db::serialize
+ * format. The journal lives next to it, in path + ".journal".
+ *
+ * Loading new contents into the database while the journal is open
+ * triggers a compaction, since the journal cannot describe a reload.
+ */
+class BC_API tx_journal
+{
+public:
+    BC_API ~tx_journal();
+
+    /**
+     * @param compact_size the journal size, in bytes, at which a
+     * background compaction begins. Zero means only compact on request.
+     */
+    BC_API tx_journal(tx_db& db, const std::string& path,
+        size_t compact_size=16*1024*1024);
+
+    /**
+     * Recovers the database from the snapshot and journal on disk,
+     * and then begins journaling every change made to the database.
+     * @return false if the files exist but cannot be read or written.
+     */
+    BC_API bool open();
+
+    /**
+     * Stops journaling, and waits for any compaction to finish.
+     */
+    BC_API void close();
+
+    /**
+     * Flushes the journal to stable storage.
+     */
+    BC_API bool sync();
+
+    /**
+     * Folds the journal into a fresh snapshot on a background thread.
+     * @return false if the journal is not open.
+     */
+    BC_API bool compact();
+
+    /**
+     * Returns false if a journal write or compaction has failed.
+     * A failed write starts a compaction, so journaling can pick up
+     * again from a fresh snapshot once the disk recovers.
+     */
+    BC_API bool good();
+
+private:
+    // - tx_db: ------------------------
+    // These are all called with the database write lock held.
+    friend class tx_db;
+    void write_insert(const tx_db::tx_data& data, tx_state state,
+        time_t timestamp);
+    void write_confirmed(const bc::hash_digest& tx_hash, size_t block_height);
+    void write_unconfirmed(const bc::hash_digest& tx_hash);
+    void write_forget(const bc::hash_digest& tx_hash);
+    void write_height(size_t height);
+    void write_timestamp(const bc::hash_digest& tx_hash, time_t timestamp);
+    void write_reload();
+
+    // - Internal: ---------------------
+    uint8_t* begin_record(uint8_t type, size_t size);
+    void append();
+    bool replay(const std::string& path, bool& replayed);
+    void apply(uint8_t type, const uint8_t* begin, const uint8_t* end);
+    bool open_journal();
+    bool rotate();
+    void start_compaction();
+    void run_compaction(tx_snapshot snapshot);
+
+    tx_db& db_;
+    const std::string path_;
+    const std::string journal_path_;
+    const std::string old_path_;
+    const size_t compact_size_;
+
+    // These are guarded by the database write lock:
+    int fd_;
+    size_t size_;
+    bc::data_chunk record_;
+    bool compacting_;
+    bool compact_again_;
+
+    std::thread compactor_;
+    std::atomic<bool> failed_;
+};
+
+} // namespace libwallet
+
+#endif
+
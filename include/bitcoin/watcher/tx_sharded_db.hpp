@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBBITCOIN_WATCHER_TX_SHARDED_DB_HPP
+#define LIBBITCOIN_WATCHER_TX_SHARDED_DB_HPP
+
+#include <bitcoin/watcher/tx_db.hpp>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace libwallet {
+
+/**
+ * A transaction database split into several independently-locked
+ * shards, so writers working on different transactions rarely wait
+ * for each other.
+ *
+ * Each transaction lives in the shard picked by the last bytes of its hash.
+ * Lookups by hash only touch that one shard. Queries that span the whole
+ * database, such as get_utxos and serialize, gather their results from
+ * every shard in turn, so they may see some shards slightly later than
+ * others. The exception is serialize, which holds all the shards still
+ * while it collects their rows.
+ *
+ * Each shard's spend index covers the spends of its own outputs, so its
+ * utxo index is complete without looking at the other shards. Inserting
+ * a transaction passes its spends on to the shards holding the outputs
+ * it spends, once the transaction itself is in, and forgetting it takes
+ * them back afterwards. Inserts and forgets of transactions in the same
+ * shard wait for each other's spends to land, so they can't arrive out
+ * of order. Readers aren't held up, though, so for a moment they can
+ * see a transaction while the outputs it spends still show as unspent,
+ * or the other way around.
+ *
+ * The shards share one script pool, so a script that several shards use
+ * is still only stored once.
+ *
+ * A tx_updater can keep this in sync just like a plain tx_db. Changes to
+ * one transaction go to its shard, while new block heights go to all of
+ * them. Each shard checks for forks among its own transactions, which
+ * can mark a few more of them for checking than a single database would.
+ */
+class BC_API tx_sharded_db
+  : public tx_store
+{
+public:
+    BC_API ~tx_sharded_db();
+    BC_API tx_sharded_db(unsigned shards=16,
+        unsigned unconfirmed_timeout=24*60*60);
+    tx_sharded_db(const tx_sharded_db&) = delete;
+    tx_sharded_db& operator=(const tx_sharded_db&) = delete;
+
+    BC_API size_t shard_count() const;
+
+    /**
+     * Returns the highest block that any shard has seen.
+     */
+    BC_API virtual size_t last_height() override;
+
+    BC_API virtual bool has_tx(bc::hash_digest tx_hash) override;
+    BC_API bc::transaction_type get_tx(bc::hash_digest tx_hash);
+    BC_API virtual tx_ptr get_tx_ptr(bc::hash_digest tx_hash) override;
+    BC_API size_t get_tx_height(bc::hash_digest tx_hash);
+    BC_API bool is_spend(bc::hash_digest tx_hash,
+        const address_set& addresses);
+    BC_API bool has_history(const bc::payment_address& address);
+
+    /**
+     * Get all unspent outputs in the database.
+     * An output counts as spent if a transaction in any shard spends it.
+     */
+    BC_API bc::output_info_list get_utxos();
+
+    /**
+     * Get just the utxos corresponding to a set of addresses.
+     */
+    BC_API bc::output_info_list get_utxos(const address_set& addresses);
+
+    BC_API output_point_list get_history(const bc::payment_address& address);
+
+    /**
+     * Captures the current contents of every shard at once.
+     * This holds all the shard locks together for a moment, so the
+     * shards all come from the same point in time, although an output
+     * may still show as unspent if its spend went in just then.
+     */
+    BC_API tx_snapshot snapshot();
+
+    /**
+     * Write out every shard as a single database, in the same format
+     * tx_db uses, so either class can load the result.
+     */
+    BC_API bc::data_chunk serialize(unsigned threads=0);
+    BC_API bool serialize_to(const tx_db::sink_fn& sink, unsigned threads=0);
+
+    /**
+     * Reconstitute the database from a saved tx_db or tx_sharded_db.
+     * The rows are decoded once, and then dealt out to the shards.
+     */
+    BC_API bool load(const bc::data_chunk& data, unsigned threads=0);
+    BC_API bool load_file(const std::string& path, unsigned threads=0);
+
+    /**
+     * Returns a number that increases with every change to any shard.
+     */
+    BC_API uint64_t sequence();
+
+    BC_API script_pool_stats script_usage();
+
+    /**
+     * Debug dump to show db contents, one shard after another.
+     */
+    BC_API void dump(std::ostream& out);
+
+    /**
+     * Insert a new transaction into its shard.
+     * @return true if the callback should be fired.
+     */
+    BC_API virtual bool insert(const bc::transaction_type& tx,
+        tx_state state) override;
+
+    /**
+     * Insert several transactions at once, taking each shard's lock
+     * at most once.
+     */
+    BC_API virtual std::vector<bool> insert_batch(
+        const tx_entry_list& entries) override;
+
+private:
+    // - Updater: ----------------------
+    virtual void at_height(size_t height) override;
+    virtual void confirmed(bc::hash_digest tx_hash,
+        size_t block_height) override;
+    virtual void unconfirmed(bc::hash_digest tx_hash) override;
+    virtual void forget(bc::hash_digest tx_hash) override;
+    virtual void reset_timestamp(bc::hash_digest tx_hash) override;
+    virtual void foreach_unconfirmed(hash_fn&& f) override;
+    virtual void foreach_forked(hash_fn&& f) override;
+    virtual void foreach_unsent(tx_fn&& f) override;
+
+    // - Internal: ---------------------
+    typedef std::vector<tx_db::read_lock> lock_list;
+    typedef std::vector<std::unique_lock<std::mutex>> route_lock_list;
+
+    size_t shard_index(const bc::hash_digest& tx_hash) const;
+    tx_db& shard_for(const bc::hash_digest& tx_hash);
+    void add_spends(std::vector<tx_db::spend_list>& out,
+        const bc::hash_digest& tx_hash, const bc::transaction_type& tx);
+    void route_spends(const std::vector<tx_db::spend_list>& spends,
+        bool add);
+    void fork_check(size_t height, const tx_db* skip);
+    tx_db::row_list save_order(lock_list& locks, size_t& last_height);
+    bool load_data(const uint8_t* begin, const uint8_t* end,
+        unsigned threads);
+    void split(size_t last_height, const tx_db::row_map& rows,
+        const tx_db::arena_list& arenas);
+
+    const unsigned unconfirmed_timeout_;
+    const script_pool_ptr scripts_;
+    std::vector<std::unique_ptr<tx_db>> shards_;
+
+    // One per shard. Inserting or forgetting a transaction holds its
+    // shard's route lock until its spends reach the shards that own the
+    // spent outputs. Route locks go in shard order, before any shard lock:
+    std::unique_ptr<std::mutex[]> routes_;
+};
+
+} // namespace libwallet
+
+#endif
+
@@ -25,6 +25,8 @@
 
 namespace libwallet {
 
+typedef std::vector<bc::transaction_type> tx_list;
+
 /**
  * Interface containing the events the updater can trigger.
  */
@@ -38,6 +40,16 @@ public:
      */
     virtual void on_add(const bc::transaction_type& tx) = 0;
 
+    /**
+     * Called when the updater inserts several transactions at once.
+     * By default, this simply calls on_add for each one.
+     */
+    virtual void on_add_batch(const tx_list& txs)
+    {
+        for (auto& tx: txs)
+            on_add(tx);
+    }
+
     /**
      * Called when the updater detects a new block.
      */
@@ -63,13 +75,18 @@ public:
 
 /**
  * Syncs a set of transactions with the bitcoin server.
+ *
+ * Transactions the server has sent, but which have not yet gone into
+ * the database when the updater is destroyed, are dropped rather than
+ * flushed, since the database and callbacks may already be gone.
+ * The next updater to watch the same addresses fetches them again.
  */
 class BC_API tx_updater
   : public bc::client::sleeper
 {
 public:
     BC_API ~tx_updater();
-    BC_API tx_updater(tx_db& db, bc::client::obelisk_codec& codec,
+    BC_API tx_updater(tx_store& db, bc::client::obelisk_codec& codec,
         tx_callbacks& callbacks);
     void start();
 
@@ -87,6 +104,8 @@ private:
     void get_inputs(const bc::transaction_type& tx);
     void query_done();
     void queue_get_indices();
+    void add_pending(const bc::transaction_type& tx);
+    void flush_pending();
 
     // Server queries:
     void get_height();
@@ -96,7 +115,7 @@ private:
     void send_tx(const bc::transaction_type& tx);
     void query_address(const bc::payment_address& address);
 
-    tx_db& db_;
+    tx_store& db_;
     bc::client::obelisk_codec& codec_;
     tx_callbacks& callbacks_;
 
@@ -107,6 +126,17 @@ private:
     };
     std::unordered_map<bc::payment_address, address_row> rows_;
 
+    // Transactions fetched from the server, but not yet in the database.
+    // These go into the database as a single batch once the replies
+    // die down. Index results that arrive in the meantime wait here too:
+    struct pending_tx
+    {
+        bc::transaction_type tx;
+        tx_state state;
+        size_t block_height;
+    };
+    std::unordered_map<bc::hash_digest, pending_tx> pending_;
+
     bool failed_;
     size_t queued_queries_;
     size_t queued_get_indices_;
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "crc32c.hpp"
+#include <array>
+#include <cstring>
+// The hardware instruction only has a 64-bit form on x86-64:
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#define CRC32C_HARDWARE
+#include <nmmintrin.h>
+#endif
+
+namespace libwallet {
+
+#ifndef CRC32C_HARDWARE
+// The Castagnoli polynomial, in reversed bit order:
+constexpr uint32_t crc32c_polynomial = 0x82f63b78;
+
+typedef std::array<std::array<uint32_t, 256>, 4> crc_table;
+
+/**
+ * Builds the lookup tables for the slicing-by-4 algorithm.
+ */
+static crc_table make_table()
+{
+    crc_table table;
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (crc & 1 ? crc32c_polynomial : 0);
+        table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+        for (size_t slice = 1; slice < table.size(); ++slice)
+            table[slice][i] = (table[slice - 1][i] >> 8) ^
+                table[0][table[slice - 1][i] & 0xff];
+    return table;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t size)
+{
+    crc = ~crc;
+
+#ifdef CRC32C_HARDWARE
+    // Use the hardware instruction when the compiler allows it:
+    for (; 8 <= size; data += 8, size -= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc = static_cast<uint32_t>(_mm_crc32_u64(crc, word));
+    }
+    for (; size; ++data, --size)
+        crc = _mm_crc32_u8(crc, *data);
+#else
+    static const crc_table table = make_table();
+
+    // Process four bytes at a time:
+    for (; 4 <= size; data += 4, size -= 4)
+    {
+        crc ^= uint32_t(data[0]) | uint32_t(data[1]) << 8 |
+            uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24;
+        crc = table[3][crc & 0xff] ^ table[2][(crc >> 8) & 0xff] ^
+            table[1][(crc >> 16) & 0xff] ^ table[0][crc >> 24];
+    }
+    for (; size; ++data, --size)
+        crc = table[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+#endif
+
+    return ~crc;
+}
+
+} // namespace libwallet
+
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBBITCOIN_WATCHER_CRC32C_HPP
+#define LIBBITCOIN_WATCHER_CRC32C_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace libwallet {
+
+/**
+ * Computes a CRC-32C (Castagnoli) checksum.
+ * To checksum data in pieces, pass the result of one call as the
+ * starting crc of the next.
+ */
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t size);
+
+inline uint32_t crc32c(const uint8_t* data, size_t size)
+{
+    return crc32c(0, data, size);
+}
+
+} // namespace libwallet
+
+#endif
+
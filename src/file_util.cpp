@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "file_util.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace libwallet {
+
+bool file_exists(const std::string& path)
+{
+    struct stat info;
+    return !stat(path.c_str(), &info);
+}
+
+bool read_file(const std::string& path, bc::data_chunk& out)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) < 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    out.resize(info.st_size);
+    size_t done = 0;
+    while (done < out.size())
+    {
+        auto size = read(fd, out.data() + done, out.size() - done);
+        if (size < 0 && EINTR == errno)
+            continue;
+        if (size <= 0)
+            break;
+        done += size;
+    }
+    close(fd);
+
+    // A read error, or a file that shrank under us, leaves the data short.
+    // Callers would take that for a torn tail, so it has to be a failure:
+    return done == out.size();
+}
+
+bool write_all(int fd, const uint8_t* data, size_t size)
+{
+    while (size)
+    {
+        auto done = write(fd, data, size);
+        if (done < 0 && EINTR == errno)
+            continue;
+        if (done <= 0)
+            return false;
+        data += done;
+        size -= done;
+    }
+    return true;
+}
+
+/**
+ * Flushes a directory entry to disk, so a rename inside it is durable.
+ */
+static bool sync_directory(const std::string& path)
+{
+    auto slash = path.rfind('/');
+    std::string directory = ".";
+    if (std::string::npos != slash)
+        directory = path.substr(0, slash + 1);
+
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool success = !fsync(fd);
+    close(fd);
+    return success;
+}
+
+bool replace_file(const std::string& path, const writer_fn& write)
+{
+    auto temp_path = path + ".tmp";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    auto sink = [fd](const uint8_t* data, size_t size)
+    {
+        return write_all(fd, data, size);
+    };
+    bool success = write(sink) && !fsync(fd);
+    success = !close(fd) && success;
+    if (!success)
+    {
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0)
+    {
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return sync_directory(path);
+}
+
+mapped_file::~mapped_file()
+{
+    if (data_)
+        munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+mapped_file::mapped_file(const std::string& path)
+  : data_(nullptr), size_(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat info;
+    if (fstat(fd, &info) < 0 || !info.st_size)
+    {
+        close(fd);
+        return;
+    }
+
+    // Readers generally walk the file from front to back:
+    size_t size = info.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+        return;
+    madvise(map, size, MADV_SEQUENTIAL);
+    data_ = static_cast<const uint8_t*>(map);
+    size_ = size;
+}
+
+bool mapped_file::good() const
+{
+    return nullptr != data_;
+}
+
+const uint8_t* mapped_file::begin() const
+{
+    return data_;
+}
+
+const uint8_t* mapped_file::end() const
+{
+    return data_ + size_;
+}
+
+size_t mapped_file::size() const
+{
+    return size_;
+}
+
+} // namespace libwallet
+
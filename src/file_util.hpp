@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBBITCOIN_WATCHER_FILE_UTIL_HPP
+#define LIBBITCOIN_WATCHER_FILE_UTIL_HPP
+
+#include <bitcoin/watcher/tx_db.hpp>
+#include <string>
+
+namespace libwallet {
+
+/**
+ * Produces the contents of a file by feeding them to a sink.
+ */
+typedef std::function<bool (const tx_db::sink_fn& sink)> writer_fn;
+
+/**
+ * Returns true if something exists at the given path.
+ */
+bool file_exists(const std::string& path);
+
+/**
+ * Reads a whole file into memory.
+ * @return false unless every byte the file held when opened was read.
+ */
+bool read_file(const std::string& path, bc::data_chunk& out);
+
+/**
+ * Writes a buffer to a file descriptor, retrying short writes.
+ */
+bool write_all(int fd, const uint8_t* data, size_t size);
+
+/**
+ * Replaces a file atomically. The contents go to a temporary file first,
+ * which is flushed to disk and then renamed over the target, so a crash
+ * leaves either the old file or the new one, but never a mix of the two.
+ */
+bool replace_file(const std::string& path, const writer_fn& write);
+
+/**
+ * A read-only memory mapping of a whole file.
+ */
+class mapped_file
+{
+public:
+    ~mapped_file();
+    mapped_file(const std::string& path);
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    /**
+     * Returns false if the file could not be mapped, or is empty.
+     */
+    bool good() const;
+
+    const uint8_t* begin() const;
+    const uint8_t* end() const;
+    size_t size() const;
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+};
+
+} // namespace libwallet
+
+#endif
+
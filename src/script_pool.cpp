@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <bitcoin/watcher/script_pool.hpp>
+#include <algorithm>
+
+namespace libwallet {
+
+constexpr size_t script_pool::shard_count;
+
+/**
+ * FNV-1a, which is plenty for scripts this short.
+ */
+static uint64_t script_hash(const uint8_t* begin, const uint8_t* end)
+{
+    uint64_t out = 0xcbf29ce484222325ull;
+    for (auto i = begin; i != end; ++i)
+        out = (out ^ *i) * 0x100000001b3ull;
+    return out;
+}
+
+BC_API script_pool::~script_pool()
+{
+    for (auto& shard: shards_)
+        for (auto& entry: shard.entries)
+            ::operator delete(entry.second);
+}
+
+BC_API script_pool::script_pool()
+{
+    for (auto& shard: shards_)
+        shard.stats = script_pool_stats{0, 0, 0, 0, 0};
+}
+
+const script_pool::entry* script_pool::intern(const uint8_t* begin,
+    const uint8_t* end)
+{
+    auto hash = script_hash(begin, end);
+    uint32_t size = static_cast<uint32_t>(end - begin);
+    auto& shard = shards_[hash % shard_count];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.stats.references += 1;
+    shard.stats.referenced_bytes += size;
+
+    auto range = shard.entries.equal_range(hash);
+    for (auto i = range.first; i != range.second; ++i)
+    {
+        auto found = i->second;
+        if (found->size == size && std::equal(begin, end, found->data()))
+        {
+            ++found->references;
+            return found;
+        }
+    }
+
+    auto created = static_cast<entry*>(::operator new(sizeof(entry) + size));
+    created->hash = hash;
+    created->size = size;
+    created->references = 1;
+    std::copy(begin, end, reinterpret_cast<uint8_t*>(created + 1));
+    shard.entries.emplace(hash, created);
+    shard.stats.scripts += 1;
+    shard.stats.bytes += size;
+    return created;
+}
+
+void script_pool::release(const entry* script)
+{
+    auto& shard = shards_[script->hash % shard_count];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.stats.references -= 1;
+    shard.stats.referenced_bytes -= script->size;
+
+    auto range = shard.entries.equal_range(script->hash);
+    for (auto i = range.first; i != range.second; ++i)
+    {
+        if (i->second != script)
+            continue;
+        if (--i->second->references)
+            return;
+        shard.stats.scripts -= 1;
+        shard.stats.bytes -= script->size;
+        ::operator delete(i->second);
+        shard.entries.erase(i);
+        return;
+    }
+}
+
+script_pool_stats script_pool::stats()
+{
+    // A hash table node holds the next pointer and the key-value pair:
+    typedef decltype(shard::entries) entry_map;
+    constexpr size_t node_size =
+        sizeof(void*) + sizeof(entry_map::value_type);
+
+    script_pool_stats out{0, 0, 0, 0, 0};
+    for (auto& shard: shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        out.scripts += shard.stats.scripts;
+        out.references += shard.stats.references;
+        out.bytes += shard.stats.bytes;
+        out.referenced_bytes += shard.stats.referenced_bytes;
+        out.overhead_bytes += shard.entries.bucket_count() * sizeof(void*);
+    }
+    out.overhead_bytes += out.scripts * (sizeof(entry) + node_size) +
+        out.references * sizeof(const entry*);
+    return out;
+}
+
+} // namespace libwallet
+
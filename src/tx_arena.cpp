@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <bitcoin/watcher/tx_arena.hpp>
+#include <stdint.h>
+
+namespace libwallet {
+
+BC_API tx_arena::~tx_arena()
+{
+    for (auto slab: slabs_)
+        ::operator delete(slab);
+}
+
+BC_API tx_arena::tx_arena(size_t slab_size)
+  : slab_size_(slab_size),
+    next_(nullptr),
+    end_(nullptr),
+    reserved_(0),
+    used_(0)
+{
+}
+
+void* tx_arena::allocate(size_t size, size_t alignment)
+{
+    auto address = reinterpret_cast<uintptr_t>(next_);
+    auto padding = (alignment - address % alignment) % alignment;
+    if (!next_ || size_t(end_ - next_) < padding + size)
+    {
+        // Oversized requests get a slab of their own,
+        // so they don't waste the rest of the current one:
+        auto slab_size = size + alignment;
+        if (slab_size <= slab_size_)
+            slab_size = slab_size_;
+        auto slab = static_cast<uint8_t*>(::operator new(slab_size));
+        slabs_.push_back(slab);
+        reserved_ += slab_size;
+        if (slab_size != slab_size_)
+        {
+            used_ += size;
+            auto offset = (alignment -
+                reinterpret_cast<uintptr_t>(slab) % alignment) % alignment;
+            return slab + offset;
+        }
+
+        next_ = slab;
+        end_ = slab + slab_size;
+        address = reinterpret_cast<uintptr_t>(next_);
+        padding = (alignment - address % alignment) % alignment;
+    }
+
+    auto out = next_ + padding;
+    next_ = out + size;
+    used_ += size;
+    return out;
+}
+
+size_t tx_arena::reserved() const
+{
+    return reserved_;
+}
+
+size_t tx_arena::used() const
+{
+    return used_;
+}
+
+size_t tx_arena::slabs() const
+{
+    return slabs_.size();
+}
+
+} // namespace libwallet
+
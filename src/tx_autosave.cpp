@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <bitcoin/watcher/tx_autosave.hpp>
+#include "crc32c.hpp"
+#include "file_util.hpp"
+#include <unistd.h>
+
+namespace libwallet {
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+typedef std::chrono::steady_clock save_clock;
+
+/**
+ * Replaces a file, timing each phase of the write.
+ * Also computes the checksum of everything written.
+ */
+static bool timed_replace(const std::string& path, const writer_fn& write,
+    autosave_stats& stats, uint32_t& crc)
+{
+    auto start = save_clock::now();
+    save_clock::duration write_time(0);
+    save_clock::time_point encode_done;
+    crc = 0;
+    auto timed_write = [&](const tx_db::sink_fn& sink)
+    {
+        auto timed_sink = [&](const uint8_t* data, size_t size)
+        {
+            crc = crc32c(crc, data, size);
+            auto before = save_clock::now();
+            bool success = sink(data, size);
+            write_time += save_clock::now() - before;
+            stats.bytes += size;
+            return success;
+        };
+        bool success = write(timed_sink);
+        encode_done = save_clock::now();
+        return success;
+    };
+    if (!replace_file(path, timed_write))
+        return false;
+    auto commit_done = save_clock::now();
+
+    stats.encode_time = duration_cast<microseconds>(
+        encode_done - start - write_time);
+    stats.write_time = duration_cast<microseconds>(write_time);
+    stats.commit_time = duration_cast<microseconds>(commit_done - encode_done);
+    return true;
+}
+
+BC_API tx_autosave::~tx_autosave()
+{
+    stop();
+}
+
+/**
+ * Anything already in the database counts as saved,
+ * since it presumably just came from the file we are saving to.
+ */
+BC_API tx_autosave::tx_autosave(tx_db& db, const std::string& path,
+    unsigned interval, uint64_t dirty_threshold, unsigned merge_ratio)
+  : db_(db),
+    path_(path),
+    patch_path_(path + ".patch"),
+    interval_(interval),
+    dirty_threshold_(dirty_threshold),
+    merge_ratio_(merge_ratio),
+    saved_changes_(db.sequence()),
+    has_base_(false),
+    base_tag_(0),
+    base_sequence_(0),
+    base_bytes_(0),
+    stopping_(false),
+    failed_(false),
+    stats_()
+{
+}
+
+bool tx_autosave::load()
+{
+    if (!file_exists(path_))
+        return true;
+    bc::data_chunk base;
+    if (!read_file(path_, base) || !db_.load(base))
+        return false;
+
+    std::lock_guard<std::mutex> save_lock(save_mutex_);
+    has_base_ = true;
+    base_tag_ = crc32c(base.data(), base.size());
+    base_bytes_ = base.size();
+    base_sequence_ = db_.sequence();
+    bc::data_chunk().swap(base);
+
+    // The patch rows become changes relative to the full file,
+    // so the next patch will carry them forward:
+    bc::data_chunk patch;
+    if (file_exists(patch_path_) && (!read_file(patch_path_, patch) ||
+        !db_.load_patch(patch, base_tag_)))
+        unlink(patch_path_.c_str());
+
+    saved_changes_ = db_.sequence();
+    return true;
+}
+
+void tx_autosave::start()
+{
+    if (thread_.joinable())
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = false;
+    thread_ = std::thread(&tx_autosave::run, this);
+}
+
+bool tx_autosave::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wakeup_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+
+    return save_changes(1);
+}
+
+bool tx_autosave::save()
+{
+    return save_changes(1);
+}
+
+autosave_stats tx_autosave::last_stats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+bool tx_autosave::good()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !failed_;
+}
+
+/**
+ * Saves the database if at least `threshold` changes have happened
+ * since the last save. This writes a patch if possible,
+ * and falls back on a full save otherwise.
+ */
+bool tx_autosave::save_changes(uint64_t threshold)
+{
+    std::lock_guard<std::mutex> save_lock(save_mutex_);
+    if (db_.sequence() - saved_changes_ < threshold)
+        return true;
+
+    autosave_stats stats = autosave_stats();
+    uint64_t until = 0;
+    bool need_full = !has_base_;
+    bool success = false;
+    if (!need_full)
+        success = save_patch(stats, until, need_full);
+    if (need_full)
+        success = save_full(stats, until);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_ = !success;
+    if (!success)
+        return false;
+    stats.changes = until - saved_changes_;
+    stats_ = stats;
+    saved_changes_ = until;
+    return true;
+}
+
+/**
+ * Writes the whole database out, which becomes the new base for patches.
+ */
+bool tx_autosave::save_full(autosave_stats& stats, uint64_t& until)
+{
+    stats = autosave_stats();
+    stats.full = true;
+
+    // Capture the database. The snapshot shares the transactions
+    // themselves with the live database, so this is just a table copy:
+    auto start = save_clock::now();
+    auto snapshot = [this, &until]()
+    {
+        tx_db::read_lock lock(db_.mutex_);
+        until = db_.changes_;
+        return db_.make_snapshot();
+    }();
+    stats.snapshot_time = duration_cast<microseconds>(
+        save_clock::now() - start);
+
+    // Encode and write the snapshot:
+    auto write = [&snapshot](const tx_db::sink_fn& sink)
+    {
+        return snapshot.serialize_to(sink);
+    };
+    uint32_t crc;
+    if (!timed_replace(path_, write, stats, crc))
+        return false;
+
+    // Any existing patch is now out of date. If removing it fails,
+    // its base tag will no longer match, so it gets ignored anyhow:
+    has_base_ = true;
+    base_tag_ = crc;
+    base_sequence_ = until;
+    base_bytes_ = stats.bytes;
+    unlink(patch_path_.c_str());
+    db_.prune_forgotten(until);
+    return true;
+}
+
+/**
+ * Writes out the rows that changed since the last full save.
+ * @param need_full set to true if only a full save will do, either
+ * because the database was reloaded or because the patch is too big.
+ */
+bool tx_autosave::save_patch(autosave_stats& stats, uint64_t& until,
+    bool& need_full)
+{
+    stats = autosave_stats();
+
+    // Patches are small, so encode them into memory with the lock held:
+    auto start = save_clock::now();
+    bc::data_chunk patch;
+    auto sink = [&patch](const uint8_t* data, size_t size)
+    {
+        patch.insert(patch.end(), data, data + size);
+        return true;
+    };
+    if (!db_.serialize_patch(base_sequence_, base_tag_, sink, until))
+    {
+        need_full = true;
+        return false;
+    }
+    stats.snapshot_time = duration_cast<microseconds>(
+        save_clock::now() - start);
+
+    // Once the patch gets big enough, merge it into a new full file:
+    if (base_bytes_ < patch.size() * merge_ratio_)
+    {
+        need_full = true;
+        return false;
+    }
+
+    auto write = [&patch](const tx_db::sink_fn& sink)
+    {
+        return sink(patch.data(), patch.size());
+    };
+    uint32_t crc;
+    return timed_replace(patch_path_, write, stats, crc);
+}
+
+void tx_autosave::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_)
+    {
+        wakeup_.wait_for(lock, interval_);
+        if (stopping_)
+            break;
+
+        lock.unlock();
+        save_changes(dirty_threshold_);
+        lock.lock();
+    }
+}
+
+} // namespace libwallet
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <bitcoin/watcher/tx_checkpoint.hpp>
+#include "crc32c.hpp"
+#include "file_util.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace libwallet {
+
+// Checkpoint file format. The header is the magic bytes, the generation,
+// and a checksum of those. The footer is the size of the database that
+// sits between the two, the generation again, more magic bytes, and
+// a checksum covering both the header and the footer:
+constexpr uint32_t checkpoint_magic = 0x5c4e8d21;
+constexpr uint32_t checkpoint_footer_magic = 0x218d4e5c;
+constexpr size_t checkpoint_header_size = 4 + 8 + 4;
+constexpr size_t checkpoint_footer_size = 8 + 8 + 4 + 4;
+
+/**
+ * Reads exactly `size` bytes at the given file offset.
+ */
+static bool read_at(int fd, uint8_t* out, size_t size, off_t offset)
+{
+    while (size)
+    {
+        auto done = pread(fd, out, size, offset);
+        if (done <= 0)
+            return false;
+        out += done;
+        size -= done;
+        offset += done;
+    }
+    return true;
+}
+
+/**
+ * Checks a checkpoint's header and footer, without touching the
+ * database in between.
+ * @return the generation number, or 0 if the file is no good.
+ */
+static uint64_t read_generation(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat info;
+    uint8_t frame[checkpoint_header_size + checkpoint_footer_size];
+    size_t footer_offset = 0;
+    bool success = !fstat(fd, &info) &&
+        sizeof(frame) <= size_t(info.st_size);
+    if (success)
+    {
+        footer_offset = info.st_size - checkpoint_footer_size;
+        success = read_at(fd, frame, checkpoint_header_size, 0) &&
+            read_at(fd, frame + checkpoint_header_size,
+                checkpoint_footer_size, footer_offset);
+    }
+    close(fd);
+    if (!success)
+        return 0;
+
+    auto header = bc::make_deserializer(frame, frame + sizeof(frame));
+    if (header.read_4_bytes() != checkpoint_magic)
+        return 0;
+    uint64_t generation = header.read_8_bytes();
+    if (header.read_4_bytes() != crc32c(frame, 4 + 8))
+        return 0;
+
+    auto footer = header;
+    uint64_t size = footer.read_8_bytes();
+    if (checkpoint_header_size + size != footer_offset)
+        return 0;
+    if (footer.read_8_bytes() != generation)
+        return 0;
+    if (footer.read_4_bytes() != checkpoint_footer_magic)
+        return 0;
+    if (footer.read_4_bytes() != crc32c(frame, sizeof(frame) - 4))
+        return 0;
+    return generation;
+}
+
+BC_API tx_checkpoint::tx_checkpoint(tx_db& db, const std::string& path,
+    unsigned generations)
+  : db_(db),
+    path_(path),
+    generations_(std::max(1u, generations)),
+    scanned_(false),
+    generation_(0)
+{
+}
+
+bool tx_checkpoint::save()
+{
+    // Don't clobber the newest generation on disk:
+    if (!scanned_)
+    {
+        auto found = scan();
+        if (!found.empty())
+            generation_ = found.front().generation;
+        scanned_ = true;
+    }
+    uint64_t generation = generation_ + 1;
+
+    // The snapshot lets us write without holding the database lock:
+    auto snapshot = db_.snapshot();
+    auto write = [&snapshot, generation](const tx_db::sink_fn& sink)
+    {
+        uint8_t frame[checkpoint_header_size + checkpoint_footer_size];
+        auto header = bc::make_serializer(frame);
+        header.write_4_bytes(checkpoint_magic);
+        header.write_8_bytes(generation);
+        header.write_4_bytes(crc32c(frame, 4 + 8));
+        if (!sink(frame, checkpoint_header_size))
+            return false;
+
+        uint64_t size = 0;
+        auto counting_sink = [&sink, &size](const uint8_t* data, size_t length)
+        {
+            size += length;
+            return sink(data, length);
+        };
+        if (!snapshot.serialize_to(counting_sink))
+            return false;
+
+        auto footer = bc::make_serializer(frame + checkpoint_header_size);
+        footer.write_8_bytes(size);
+        footer.write_8_bytes(generation);
+        footer.write_4_bytes(checkpoint_footer_magic);
+        footer.write_4_bytes(crc32c(frame, sizeof(frame) - 4));
+        return sink(frame + checkpoint_header_size, checkpoint_footer_size);
+    };
+    if (!replace_file(slot_path(generation), write))
+        return false;
+
+    generation_ = generation;
+    return true;
+}
+
+bool tx_checkpoint::load(unsigned threads)
+{
+    auto found = scan();
+    scanned_ = true;
+    if (found.empty())
+    {
+        // Nothing intact, which is only a problem if something is there:
+        for (unsigned slot = 0; slot < generations_; ++slot)
+            if (file_exists(slot_path(slot)))
+                return false;
+        return true;
+    }
+
+    // New saves should come after everything on disk, even the damaged
+    // generations, so they don't end up looking older than those:
+    generation_ = found.front().generation;
+
+    // Take the newest generation that passes all its checksums.
+    // Loading checks every record as it goes, and leaves the database
+    // alone if any of them are bad:
+    for (const auto& candidate: found)
+    {
+        mapped_file file(candidate.path);
+        if (!file.good())
+            continue;
+        auto begin = file.begin() + checkpoint_header_size;
+        auto end = file.end() - checkpoint_footer_size;
+        if (db_.load_data(begin, end, threads))
+            return true;
+    }
+    return false;
+}
+
+uint64_t tx_checkpoint::generation()
+{
+    return generation_;
+}
+
+/**
+ * Finds every checkpoint with a good header and footer,
+ * sorted newest first.
+ */
+std::vector<tx_checkpoint::candidate> tx_checkpoint::scan()
+{
+    std::vector<candidate> out;
+    for (unsigned slot = 0; slot < generations_; ++slot)
+    {
+        auto path = slot_path(slot);
+        auto generation = read_generation(path);
+        if (generation && generation % generations_ == slot)
+            out.push_back(candidate{generation, path});
+    }
+    std::sort(out.begin(), out.end(),
+        [](const candidate& a, const candidate& b)
+        {
+            return a.generation > b.generation;
+        });
+    return out;
+}
+
+std::string tx_checkpoint::slot_path(uint64_t generation)
+{
+    return path_ + "." + std::to_string(generation % generations_);
+}
+
+} // namespace libwallet
+
@@ -17,51 +17,383 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <bitcoin/watcher/tx_db.hpp>
+#include <bitcoin/watcher/tx_journal.hpp>
+#include "crc32c.hpp"
+#include "file_util.hpp"
+#include <algorithm>
+#include <cstring>
+#include <thread>
 
 namespace libwallet {
 
 // Serialization stuff:
 constexpr uint32_t old_serial_magic = 0x3eab61c3; // From the watcher
 constexpr uint32_t serial_magic = 0xfecdb760;
+constexpr uint32_t serial_magic_v2 = 0xfecdb762;
+constexpr uint32_t serial_footer_magic = 0x27bdcefe;
 constexpr uint8_t serial_tx = 0x42;
+constexpr size_t serial_header_size = 4 + 8;
+constexpr size_t serial_index_entry_size = 32 + 8;
+constexpr size_t serial_footer_size = 8 + 8 + 4 + 4;
+
+// Patches reuse the version 2 record format, with a different
+// header and footer, and a special state for forgotten rows:
+constexpr uint32_t serial_patch_magic = 0xfecdb7a1;
+constexpr uint32_t serial_patch_footer_magic = 0xa1b7cdfe;
+constexpr size_t serial_patch_header_size = 4 + 4 + 8;
+constexpr size_t serial_patch_footer_size = 8 + 4;
+constexpr uint8_t serial_state_forgotten = 0xff;
+constexpr size_t serial_chunk_size = 1024 * 1024;
+
+// Each thread encodes about this much at a time when saving:
+constexpr size_t serial_run_size = 4 * 1024 * 1024;
+
+// Below this many records per thread, a parallel load isn't worth it:
+constexpr size_t load_records_per_thread = 4096;
+
+/**
+ * Collects serialized data into large chunks for a sink.
+ */
+class chunk_writer
+{
+public:
+    chunk_writer(const tx_db::sink_fn& sink)
+      : sink_(sink), buffer_(serial_chunk_size), used_(0), good_(true)
+    {
+    }
+
+    /**
+     * Returns space for exactly `size` bytes, handing the buffer off to the
+     * sink first if they won't fit. The space is only valid until the
+     * next call.
+     */
+    uint8_t* take(size_t size)
+    {
+        if (buffer_.size() < used_ + size)
+        {
+            flush();
+            if (buffer_.size() < size)
+                buffer_.resize(size);
+        }
+        auto out = buffer_.data() + used_;
+        used_ += size;
+        return out;
+    }
+
+    /**
+     * Hands any buffered data off to the sink.
+     * @return false if the sink has failed at any point.
+     */
+    bool flush()
+    {
+        if (good_ && used_)
+            good_ = sink_(buffer_.data(), used_);
+        used_ = 0;
+        return good_;
+    }
+
+private:
+    const tx_db::sink_fn& sink_;
+    bc::data_chunk buffer_;
+    size_t used_;
+    bool good_;
+};
+
+/**
+ * Returns the number of bytes write_variable_uint uses for a value.
+ */
+static size_t variable_uint_size(uint64_t value)
+{
+    if (value < 0xfd)
+        return 1;
+    if (value <= 0xffff)
+        return 3;
+    if (value <= 0xffffffff)
+        return 5;
+    return 9;
+}
+
+/**
+ * Returns the size of a version 2 record's body.
+ */
+static size_t record_body_size(uint64_t height, size_t raw_size)
+{
+    return 32 + 1 + 1 + variable_uint_size(height) + raw_size;
+}
+
+/**
+ * Returns the total size of a version 2 record, including its length
+ * prefix and checksum.
+ */
+static size_t record_size(uint64_t height, size_t raw_size)
+{
+    auto body_size = record_body_size(height, raw_size);
+    return variable_uint_size(body_size) + 4 + body_size;
+}
+
+/**
+ * Writes a single version 2 record: a length prefix, the CRC-32C of the
+ * body, and then the body itself.
+ * @param out must have room for record_size bytes.
+ * @param write_raw writes the raw_size bytes of the transaction
+ * to the pointer it gets, and returns the end of what it wrote.
+ * @return the end of the record.
+ */
+template <typename RawWriter>
+static uint8_t* write_record(uint8_t* out, const bc::hash_digest& tx_hash,
+    uint8_t state, bool need_check, uint64_t height, size_t raw_size,
+    RawWriter write_raw)
+{
+    auto body_size = record_body_size(height, raw_size);
+    auto serial = bc::make_serializer(out);
+    serial.write_variable_uint(body_size);
+    auto crc = serial.iterator();
+    auto body = crc + 4;
+    serial.set_iterator(body);
+    serial.write_hash(tx_hash);
+    serial.write_byte(state);
+    serial.write_byte(need_check);
+    serial.write_variable_uint(height);
+    auto end = write_raw(serial.iterator());
+    BITCOIN_ASSERT(end == body + body_size);
+
+    auto crc_serial = bc::make_serializer(crc);
+    crc_serial.write_4_bytes(crc32c(body, body_size));
+    return end;
+}
+
+/**
+ * Returns the address a script pays to or spends from,
+ * or an invalid address if the script is non-standard.
+ */
+static bc::payment_address script_address(const bc::script_type& script)
+{
+    bc::payment_address address;
+    if (!bc::extract(address, script))
+        return bc::payment_address();
+    return address;
+}
+
+/**
+ * Like script_address, but works on raw script bytes. The common
+ * pay-to-pubkey-hash and pay-to-script-hash output forms are matched
+ * directly, which saves parsing the script into operations.
+ * A script with a truncated push is still valid in a transaction,
+ * but doesn't parse, so it gets an invalid address like a coinbase.
+ */
+static bc::payment_address raw_script_address(bc::data_slice script)
+{
+    auto data = script.data();
+    bc::short_hash hash;
+    bc::payment_address address;
+
+    // OP_DUP OP_HASH160 [20 bytes] OP_EQUALVERIFY OP_CHECKSIG:
+    if (25 == script.size() && 0x76 == data[0] && 0xa9 == data[1] &&
+        0x14 == data[2] && 0x88 == data[23] && 0xac == data[24])
+    {
+        std::copy(data + 3, data + 23, hash.begin());
+        bc::set_public_key_hash(address, hash);
+        return address;
+    }
+
+    // OP_HASH160 [20 bytes] OP_EQUAL:
+    if (23 == script.size() && 0xa9 == data[0] && 0x14 == data[1] &&
+        0x87 == data[22])
+    {
+        std::copy(data + 2, data + 22, hash.begin());
+        bc::set_script_hash(address, hash);
+        return address;
+    }
+
+    try
+    {
+        return script_address(bc::parse_script(script));
+    }
+    catch (bc::end_of_stream)
+    {
+        return bc::payment_address();
+    }
+}
+
+static bool is_standard(const bc::payment_address& address)
+{
+    return address.version() != bc::payment_address::invalid_version;
+}
+
+// An address in a row's table is a version byte and a 20-byte hash:
+constexpr size_t address_size = 1 + 20;
+
+static uint8_t* write_address(uint8_t* out, const bc::payment_address& address)
+{
+    *out++ = address.version();
+    return std::copy(address.hash().begin(), address.hash().end(), out);
+}
+
+static bc::payment_address read_address(const uint8_t* in)
+{
+    bc::short_hash hash;
+    std::copy(in + 1, in + address_size, hash.begin());
+    bc::payment_address address;
+    address.set(in[0], hash);
+    return address;
+}
+
+/**
+ * Returns the length-prefixed script starting at `at`, inside a
+ * transaction that make_raw_data has already checked.
+ */
+static bc::data_slice script_at(const uint8_t* at, const uint8_t* end)
+{
+    auto serial = bc::make_deserializer(at, end);
+    size_t size = serial.read_variable_uint();
+    auto script = serial.iterator();
+    return bc::data_slice(script, script + size);
+}
+
+/**
+ * Returns the length of a variable-length integer from its first byte.
+ * Transactions don't always use the shortest encoding, so this can
+ * differ from variable_uint_size.
+ */
+static size_t prefix_size(uint8_t first)
+{
+    if (first < 0xfd)
+        return 1;
+    if (first == 0xfd)
+        return 3;
+    if (first == 0xfe)
+        return 5;
+    return 9;
+}
+
+/**
+ * Reads an entry from a tx_data offset table.
+ */
+static uint32_t offset_at(const uint8_t* at)
+{
+    uint32_t out;
+    std::memcpy(&out, at, sizeof(out));
+    return out;
+}
+
+/**
+ * The shared contents of a tx_snapshot.
+ */
+struct tx_db::snapshot_data
+{
+    size_t last_height;
+    unsigned unconfirmed_timeout;
+    row_map rows;
+    utxo_map utxos;
+};
 
 BC_API tx_db::~tx_db()
 {
 }
 
-BC_API tx_db::tx_db(unsigned unconfirmed_timeout)
+BC_API tx_db::tx_db(unsigned unconfirmed_timeout, bool use_arenas)
+  : tx_db(unconfirmed_timeout, use_arenas, std::make_shared<script_pool>(),
+        false)
+{
+}
+
+tx_db::tx_db(unsigned unconfirmed_timeout, bool use_arenas,
+    script_pool_ptr scripts, bool sharded)
   : last_height_(0),
-    unconfirmed_timeout_(unconfirmed_timeout)
+    journal_(nullptr),
+    changes_(0),
+    loaded_sequence_(0),
+    unconfirmed_timeout_(unconfirmed_timeout),
+    use_arenas_(use_arenas),
+    scripts_(std::move(scripts)),
+    sharded_(sharded)
 {
 }
 
 size_t tx_db::last_height()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    read_lock lock(mutex_);
 
     return last_height_;
 }
 
 bool tx_db::has_tx(bc::hash_digest tx_hash)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    read_lock lock(mutex_);
 
     return rows_.find(tx_hash) != rows_.end();
 }
 
 bc::transaction_type tx_db::get_tx(bc::hash_digest tx_hash)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    auto tx = get_tx_ptr(tx_hash);
+    if (!tx)
+        return bc::transaction_type();
+    return *tx;
+}
+
+tx_ptr tx_db::get_tx_ptr(bc::hash_digest tx_hash)
+{
+    read_lock lock(mutex_);
 
     auto i = rows_.find(tx_hash);
     if (i == rows_.end())
-        return bc::transaction_type();
-    return i->second.tx;
+        return nullptr;
+    const auto& data = i->second.data;
+    return tx_ptr(data, &data->tx());
+}
+
+tx_ptr_list tx_db::get_txs(const hash_list& tx_hashes)
+{
+    read_lock lock(mutex_);
+
+    tx_ptr_list out;
+    out.reserve(tx_hashes.size());
+    for (const auto& tx_hash: tx_hashes)
+    {
+        auto i = rows_.find(tx_hash);
+        if (i == rows_.end())
+        {
+            out.push_back(nullptr);
+            continue;
+        }
+        const auto& data = i->second.data;
+        out.push_back(tx_ptr(data, &data->tx()));
+    }
+    return out;
+}
+
+std::vector<size_t> tx_db::get_heights(const hash_list& tx_hashes)
+{
+    read_lock lock(mutex_);
+
+    std::vector<size_t> out;
+    out.reserve(tx_hashes.size());
+    for (const auto& tx_hash: tx_hashes)
+    {
+        auto i = rows_.find(tx_hash);
+        if (i == rows_.end() || i->second.state != tx_state::confirmed)
+            out.push_back(0);
+        else
+            out.push_back(i->second.block_height);
+    }
+    return out;
+}
+
+bool tx_db::with_tx(bc::hash_digest tx_hash, const tx_fn& f)
+{
+    read_lock lock(mutex_);
+
+    auto i = rows_.find(tx_hash);
+    if (i == rows_.end())
+        return false;
+    f(i->second.data->tx());
+    return true;
 }
 
 size_t tx_db::get_tx_height(bc::hash_digest tx_hash)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    read_lock lock(mutex_);
 
     auto i = rows_.find(tx_hash);
     if (i == rows_.end())
@@ -73,17 +405,17 @@ size_t tx_db::get_tx_height(bc::hash_digest tx_hash)
 
 bool tx_db::is_spend(bc::hash_digest tx_hash, const address_set& addresses)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    read_lock lock(mutex_);
 
     auto i = rows_.find(tx_hash);
     if (i == rows_.end())
         return false;
-    auto tx = i->second.tx;
 
-    for (auto& input: tx.inputs)
+    const auto& data = *i->second.data;
+    for (size_t j = 0; j < data.input_count; ++j)
     {
-        bc::payment_address address;
-        if (!bc::extract(address, input.script))
+        auto address = data.input(j).address();
+        if (!is_standard(address))
             return false;
         if (addresses.find(address) == addresses.end())
             return false;
@@ -93,176 +425,267 @@ bool tx_db::is_spend(bc::hash_digest tx_hash, const address_set& addresses)
 
 bool tx_db::has_history(const bc::payment_address& address)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-
-    for (auto& row: rows_)
-    {
-        for (auto& output: row.second.tx.outputs)
-        {
-            bc::payment_address to_address;
-            if (bc::extract(to_address, output.script))
-                if (address == to_address)
-                    return true;
-        }
-    }
+    read_lock lock(mutex_);
 
-    return false;
+    return addresses_.find(address) != addresses_.end();
 }
 
 bc::output_info_list tx_db::get_utxos()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    read_lock lock(mutex_);
 
-    // Allow inserting bc::output_point into std::set:
-    class point_cmp {
-    public:
-        bool operator () (const bc::output_point& a, const bc::output_point& b)
-        {
-            if (a.hash == b.hash)
-                return a.index < b.index;
-            else
-                return a.hash < b.hash;
-        }
-    };
+    bc::output_info_list out;
+    out.reserve(utxos_.size());
+    for (auto& utxo: utxos_)
+    {
+        bc::output_info_type info = {utxo.first, utxo.second};
+        out.push_back(info);
+    }
+    return out;
+}
 
-    // Build a list of spent outputs:
-    std::set<bc::output_point, point_cmp> spends;
-    for (auto& row: rows_)
-        for (auto& input: row.second.tx.inputs)
-            spends.insert(input.previous_output);
+bc::output_info_list tx_db::get_utxos(const address_set& addresses)
+{
+    read_lock lock(mutex_);
 
-    // Check each output against the list:
-    bc::output_info_list out;
-    for (auto& row: rows_)
+    bc::output_info_list utxos;
+    for (auto& address: addresses)
     {
-        for (uint32_t i = 0; i < row.second.tx.outputs.size(); ++i)
+        auto range = addresses_.equal_range(address);
+        for (auto i = range.first; i != range.second; ++i)
         {
-            auto& output = row.second.tx.outputs[i];
-            bc::output_point point = {row.first, i};
-            if (spends.find(point) == spends.end())
+            auto utxo = utxos_.find(i->second);
+            if (utxo != utxos_.end())
             {
-                bc::output_info_type info = {point, output.value};
-                out.push_back(info);
+                bc::output_info_type info = {utxo->first, utxo->second};
+                utxos.push_back(info);
             }
         }
     }
+    return utxos;
+}
+
+output_point_list tx_db::get_history(const bc::payment_address& address)
+{
+    read_lock lock(mutex_);
+
+    output_point_list out;
+    auto range = addresses_.equal_range(address);
+    for (auto i = range.first; i != range.second; ++i)
+        out.push_back(i->second);
     return out;
 }
 
-bc::output_info_list tx_db::get_utxos(const address_set& addresses)
+tx_snapshot tx_db::snapshot()
 {
-    auto raw = get_utxos();
+    read_lock lock(mutex_);
+    return make_snapshot();
+}
 
-    std::lock_guard<std::mutex> lock(mutex_);
-    bc::output_info_list utxos;
-    for (auto& utxo: raw)
+bc::data_chunk tx_db::serialize(unsigned threads)
+{
+    read_lock lock(mutex_);
+    auto order = save_order(rows_, unconfirmed_timeout_);
+
+    // Work out the exact size up front, so we only allocate once:
+    bc::data_chunk out;
+    out.reserve(serialized_size(order));
+    auto sink = [&out](const uint8_t* data, size_t size)
     {
-        auto i = rows_.find(utxo.point.hash);
-        BITCOIN_ASSERT(i != rows_.end());
-        const auto& tx = i->second.tx;
-        auto& output = tx.outputs[utxo.point.index];
+        out.insert(out.end(), data, data + size);
+        return true;
+    };
+    write_rows(last_height_, order, sink, threads);
+    return out;
+}
 
-        bc::payment_address to_address;
-        if (bc::extract(to_address, output.script))
-            if (addresses.find(to_address) != addresses.end())
-                utxos.push_back(utxo);
-    }
+bool tx_db::serialize_to(const sink_fn& sink, unsigned threads)
+{
+    read_lock lock(mutex_);
+    return write_rows(last_height_, save_order(rows_, unconfirmed_timeout_),
+        sink, threads);
+}
 
-    return utxos;
+uint64_t tx_db::sequence()
+{
+    read_lock lock(mutex_);
+    return changes_;
 }
 
-bc::data_chunk tx_db::serialize()
+arena_stats tx_db::arena_usage()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    read_lock lock(mutex_);
+    arena_stats out{0, 0, 0, 0};
+    for (const auto& weak: arenas_)
+    {
+        // Nothing allocates from an arena once its load is done,
+        // so reading the totals here is safe:
+        auto arena = weak.lock();
+        if (!arena)
+            continue;
+        ++out.arenas;
+        out.slabs += arena->slabs();
+        out.reserved += arena->reserved();
+        out.used += arena->used();
+    }
+    return out;
+}
 
-    std::basic_ostringstream<uint8_t> stream;
-    auto serial = bc::make_serializer(std::ostreambuf_iterator<uint8_t>(stream));
+script_pool_stats tx_db::script_usage()
+{
+    // The pool has its own locks:
+    return scripts_->stats();
+}
 
-    // Magic version bytes:
-    serial.write_4_bytes(serial_magic);
+bool tx_db::serialize_patch(uint64_t since, uint32_t base_tag,
+    const sink_fn& sink, uint64_t& until)
+{
+    read_lock lock(mutex_);
 
-    // Last block height:
-    serial.write_8_bytes(last_height_);
+    // Rows from before a reload have no sequence numbers to go by:
+    if (since < loaded_sequence_)
+        return false;
+    until = changes_;
+
+    chunk_writer out(sink);
+    auto header = bc::make_serializer(out.take(serial_patch_header_size));
+    header.write_4_bytes(serial_patch_magic);
+    header.write_4_bytes(base_tag);
+    header.write_8_bytes(last_height_);
+
+    // Changed rows:
+    auto order = save_order(rows_, unconfirmed_timeout_, since + 1);
+    uint64_t previous_height = 0;
+    for (auto row: order)
+    {
+        auto height = height_field(row->second, previous_height);
+        const auto& data = *row->second.data;
+        write_record(out.take(record_size(height, data.raw_size)), row->first,
+            static_cast<uint8_t>(row->second.state), row->second.need_check,
+            height, data.raw_size, [&data](uint8_t* at)
+            {
+                return data.write_raw(at);
+            });
+    }
 
-    // Tx table:
-    time_t now = time(nullptr);
-    for (const auto& row: rows_)
+    // Forgotten rows:
+    uint64_t count = order.size();
+    for (const auto& tombstone: forgotten_)
     {
-        // Don't save old unconfirmed transactions:
-        if (row.second.timestamp + unconfirmed_timeout_ < now)
+        if (tombstone.second <= since)
             continue;
-
-        auto height = row.second.block_height;
-        if (tx_state::unconfirmed == row.second.state)
-            height = row.second.timestamp;
-
-        serial.write_byte(serial_tx);
-        serial.write_hash(row.first);
-        serial.set_iterator(satoshi_save(row.second.tx, serial.iterator()));
-        serial.write_byte(static_cast<uint8_t>(row.second.state));
-        serial.write_8_bytes(height);
-        serial.write_byte(row.second.need_check);
+        write_record(out.take(record_size(0, 0)), tombstone.first,
+            serial_state_forgotten, false, 0, 0, [](uint8_t* at)
+            {
+                return at;
+            });
+        ++count;
     }
 
-    // The copy is not very elegant:
-    auto str = stream.str();
-    return bc::data_chunk(str.begin(), str.end());
+    auto footer = bc::make_serializer(out.take(serial_patch_footer_size));
+    footer.write_8_bytes(count);
+    footer.write_4_bytes(serial_patch_footer_magic);
+    return out.flush();
 }
 
-bool tx_db::load(const bc::data_chunk& data)
+bool tx_db::load_patch(const bc::data_chunk& data, uint32_t base_tag)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    auto begin = data.data();
+    auto end = begin + data.size();
+    if (data.size() < serial_patch_header_size + serial_patch_footer_size)
+        return false;
 
-    auto serial = bc::make_deserializer(data.begin(), data.end());
+    // Header and footer:
     size_t last_height;
-    std::unordered_map<bc::hash_digest, tx_row> rows;
-
+    uint64_t count;
     try
     {
-        // Header bytes:
-        auto magic = serial.read_4_bytes();
-        if (old_serial_magic == magic)
-            return true;
-        if (serial_magic != magic)
+        auto header = bc::make_deserializer(begin, end);
+        if (header.read_4_bytes() != serial_patch_magic)
             return false;
+        if (header.read_4_bytes() != base_tag)
+            return false;
+        last_height = header.read_8_bytes();
 
-        // Last block height:
-        last_height = serial.read_8_bytes();
-
-        time_t now = time(nullptr);
-        while (serial.iterator() != data.end())
-        {
-            if (serial.read_byte() != serial_tx)
-                return false;
-
-            bc::hash_digest hash = serial.read_hash();
-            tx_row row;
-            bc::satoshi_load(serial.iterator(), data.end(), row.tx);
-            auto step = serial.iterator() + satoshi_raw_size(row.tx);
-            serial.set_iterator(step);
-            row.state = static_cast<tx_state>(serial.read_byte());
-            row.block_height = serial.read_8_bytes();
-            row.timestamp = now;
-            if (tx_state::unconfirmed == row.state)
-                row.timestamp = row.block_height;
-            row.need_check = serial.read_byte();
-            rows[hash] = std::move(row);
-        }
+        auto footer = bc::make_deserializer(end - serial_patch_footer_size,
+            end);
+        count = footer.read_8_bytes();
+        if (footer.read_4_bytes() != serial_patch_footer_magic)
+            return false;
     }
     catch (bc::end_of_stream)
     {
         return false;
     }
+
+    // Records, decoded outside the lock:
+    row_vector rows;
+    hash_list forgotten;
+    uint64_t height = 0;
+    if (!load_records(begin + serial_patch_header_size,
+        end - serial_patch_footer_size, rows, height, nullptr, &forgotten))
+        return false;
+    if (rows.size() + forgotten.size() != count)
+        return false;
+
+    write_lock lock(mutex_);
     last_height_ = last_height;
-    rows_ = rows;
+    for (const auto& tx_hash: forgotten)
+    {
+        auto i = rows_.find(tx_hash);
+        if (i != rows_.end())
+            erase_row(i);
+    }
+    for (auto& row: rows)
+    {
+        const auto& tx_hash = row.first;
+        auto existing = rows_.modify(tx_hash);
+        if (existing)
+        {
+            unindex_tx(tx_hash, *existing);
+            unindex_state(tx_hash, *existing);
+        }
+        auto& stored = existing ? *existing : rows_[tx_hash];
+        stored = std::move(row.second);
+        forgotten_.erase(tx_hash);
+        index_tx(tx_hash, stored);
+        index_state(tx_hash, stored);
+        changed(stored);
+    }
+    changed();
+    if (journal_)
+        journal_->write_reload();
     return true;
 }
 
+bool tx_db::load(const bc::data_chunk& data, unsigned threads)
+{
+    return load_data(data.data(), data.data() + data.size(), threads);
+}
+
+bool tx_db::load_file(const std::string& path, unsigned threads)
+{
+    // Parse the file straight out of the page cache:
+    mapped_file file(path);
+    if (!file.good())
+        return false;
+    return load_data(file.begin(), file.end(), threads);
+}
+
 void tx_db::dump(std::ostream& out)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    read_lock lock(mutex_);
 
     out << "height: " << last_height_ << std::endl;
+    dump_rows(out);
+}
+
+/**
+ * Writes out every row, for dump.
+ * The caller must hold either the read or the write lock.
+ */
+void tx_db::dump_rows(std::ostream& out)
+{
     for (const auto& row: rows_)
     {
         out << "================" << std::endl;
@@ -284,51 +707,109 @@ void tx_db::dump(std::ostream& out)
                 out << "needs check." << std::endl;
             break;
         }
-        for (auto& input: row.second.tx.inputs)
+        const auto& data = *row.second.data;
+        for (size_t i = 0; i < data.input_count; ++i)
         {
-            bc::payment_address address;
-            if (bc::extract(address, input.script))
+            auto address = data.input(i).address();
+            if (is_standard(address))
                 out << "input: " << address.encoded() << std::endl;
         }
-        for (auto& output: row.second.tx.outputs)
+        for (size_t i = 0; i < data.output_count; ++i)
         {
-            bc::payment_address address;
-            if (bc::extract(address, output.script))
+            auto output = data.output(i);
+            auto address = output.address();
+            if (is_standard(address))
                 out << "output: " << address.encoded() << " " <<
-                    output.value << std::endl;
+                    output.value() << std::endl;
         }
     }
 }
 
 bool tx_db::insert(const bc::transaction_type& tx, tx_state state)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    return insert_hashed(bc::hash_transaction(tx), tx, state);
+}
+
+std::vector<bool> tx_db::insert_batch(const tx_entry_list& entries)
+{
+    // Do the hashing before taking the lock:
+    hash_list hashes;
+    std::vector<const tx_entry*> pointers;
+    hashes.reserve(entries.size());
+    pointers.reserve(entries.size());
+    for (const auto& entry: entries)
+    {
+        hashes.push_back(bc::hash_transaction(entry.first));
+        pointers.push_back(&entry);
+    }
+    return insert_hashed(hashes, pointers);
+}
+
+/**
+ * Like insert, for callers that already know the hash.
+ */
+bool tx_db::insert_hashed(const bc::hash_digest& tx_hash,
+    const bc::transaction_type& tx, tx_state state)
+{
+    // Build the row before taking the lock, to keep the lock short:
+    auto data = make_data(tx);
+
+    write_lock lock(mutex_);
 
     // Do not stomp existing tx's:
-    auto tx_hash = bc::hash_transaction(tx);
-    if (rows_.find(tx_hash) == rows_.end()) {
-        rows_[tx_hash] = tx_row{tx, state, 0, time(nullptr), false};
-        return true;
+    if (rows_.find(tx_hash) != rows_.end())
+        return false;
+
+    insert_row(tx_hash, std::move(data), state, time(nullptr));
+    return true;
+}
+
+/**
+ * Like insert_batch, for callers that already know the hashes.
+ */
+std::vector<bool> tx_db::insert_hashed(const hash_list& hashes,
+    const std::vector<const tx_entry*>& entries)
+{
+    // Do the script decoding before taking the lock:
+    std::vector<tx_data_ptr> data;
+    data.reserve(entries.size());
+    for (auto entry: entries)
+        data.push_back(make_data(entry->first));
+
+    write_lock lock(mutex_);
+
+    // Do not stomp existing tx's:
+    std::vector<bool> added(entries.size(), false);
+    time_t now = time(nullptr);
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (rows_.find(hashes[i]) != rows_.end())
+            continue;
+        insert_row(hashes[i], std::move(data[i]), entries[i]->second, now);
+        added[i] = true;
     }
-    return false;
+    return added;
 }
 
 void tx_db::at_height(size_t height)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    write_lock lock(mutex_);
     last_height_ = height;
 
     // Check for blockchain forks:
     check_fork(height);
+    changed();
+    if (journal_)
+        journal_->write_height(height);
 }
 
 void tx_db::confirmed(bc::hash_digest tx_hash, size_t block_height)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    write_lock lock(mutex_);
 
-    auto i = rows_.find(tx_hash);
-    BITCOIN_ASSERT(i != rows_.end());
-    auto& row = i->second;
+    auto found = rows_.modify(tx_hash);
+    BITCOIN_ASSERT(found);
+    auto& row = *found;
 
     // If the transaction was already confirmed in another block,
     // that means the chain has forked:
@@ -338,17 +819,23 @@ void tx_db::confirmed(bc::hash_digest tx_hash, size_t block_height)
         check_fork(row.block_height);
     }
 
+    unindex_state(tx_hash, row);
     row.state = tx_state::confirmed;
     row.block_height = block_height;
+    row.need_check = false;
+    index_state(tx_hash, row);
+    changed(row);
+    if (journal_)
+        journal_->write_confirmed(tx_hash, block_height);
 }
 
 void tx_db::unconfirmed(bc::hash_digest tx_hash)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    write_lock lock(mutex_);
 
-    auto i = rows_.find(tx_hash);
-    BITCOIN_ASSERT(i != rows_.end());
-    auto& row = i->second;
+    auto found = rows_.modify(tx_hash);
+    BITCOIN_ASSERT(found);
+    auto& row = *found;
 
     // If the transaction was already confirmed, and is now unconfirmed,
     // we probably have a block fork:
@@ -358,50 +845,91 @@ void tx_db::unconfirmed(bc::hash_digest tx_hash)
         check_fork(row.block_height);
     }
 
+    unindex_state(tx_hash, row);
     row.state = tx_state::unconfirmed;
+    row.need_check = false;
+    index_state(tx_hash, row);
+    changed(row);
+    if (journal_)
+        journal_->write_unconfirmed(tx_hash);
 }
 
 void tx_db::forget(bc::hash_digest tx_hash)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    spend_list spends;
+    forget(tx_hash, spends);
+}
 
-    rows_.erase(tx_hash);
+void tx_db::forget(bc::hash_digest tx_hash, spend_list& spends)
+{
+    write_lock lock(mutex_);
+
+    auto i = rows_.find(tx_hash);
+    if (i == rows_.end())
+        return;
+    const auto& data = *i->second.data;
+    for (size_t j = 0; j < data.input_count; ++j)
+        spends.emplace_back(data.input(j).previous_output(), tx_hash);
+    erase_row(i);
+    if (journal_)
+        journal_->write_forget(tx_hash);
 }
 
 void tx_db::reset_timestamp(bc::hash_digest tx_hash)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    write_lock lock(mutex_);
 
-    auto i = rows_.find(tx_hash);
-    if (i != rows_.end())
-        i->second.timestamp = time(nullptr);
+    auto row = rows_.modify(tx_hash);
+    if (row)
+    {
+        row->timestamp = time(nullptr);
+
+        // Only unconfirmed transactions care about their saved timestamp.
+        // The updater touches every watched row on each poll, so leaving
+        // confirmed rows alone keeps the patches and snapshot cache quiet:
+        if (tx_state::confirmed != row->state)
+        {
+            changed(*row);
+            if (journal_)
+                journal_->write_timestamp(tx_hash, row->timestamp);
+        }
+    }
 }
 
 void tx_db::foreach_unconfirmed(hash_fn&& f)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    read_lock lock(mutex_);
 
-    for (auto row: rows_)
-        if (row.second.state != tx_state::confirmed)
-            f(row.first);
+    for (const auto& tx_hash: unsent_)
+        f(tx_hash);
+    for (const auto& tx_hash: unconfirmed_)
+        f(tx_hash);
 }
 
 void tx_db::foreach_forked(hash_fn&& f)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    read_lock lock(mutex_);
 
-    for (auto row: rows_)
-        if (row.second.state == tx_state::confirmed && row.second.need_check)
-            f(row.first);
+    for (const auto& tx_hash: forked_)
+        f(tx_hash);
 }
 
 void tx_db::foreach_unsent(tx_fn&& f)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    read_lock lock(mutex_);
 
-    for (auto row: rows_)
-        if (row.second.state == tx_state::unsent)
-            f(row.second.tx);
+    for (const auto& tx_hash: unsent_)
+    {
+        auto i = rows_.find(tx_hash);
+        BITCOIN_ASSERT(i != rows_.end());
+        f(i->second.data->tx());
+    }
+}
+
+void tx_db::fork_check(size_t height)
+{
+    write_lock lock(mutex_);
+    check_fork(height);
 }
 
 /**
@@ -410,19 +938,1295 @@ void tx_db::foreach_unsent(tx_fn&& f)
  */
 void tx_db::check_fork(size_t height)
 {
-    // Find the height of next-lower block that has transactions in it:
-    size_t prev_height = 0;
-    for (auto row: rows_)
-        if (row.second.state == tx_state::confirmed &&
-            row.second.block_height < height &&
-            prev_height < row.second.block_height)
-            prev_height = row.second.block_height;
+    // Find the next-lower block that has transactions in it:
+    auto level = heights_.lower_bound(height);
+    if (level == heights_.begin())
+        return;
+    --level;
 
     // Mark all transactions at that level as needing checked:
-    for (auto row: rows_)
-        if (row.second.state == tx_state::confirmed &&
-            row.second.block_height == prev_height)
-            row.second.need_check = true;
+    for (const auto& tx_hash: level->second)
+    {
+        auto row = rows_.modify(tx_hash);
+        BITCOIN_ASSERT(row);
+        row->need_check = true;
+        forked_.insert(tx_hash);
+        changed(*row);
+    }
+}
+
+/**
+ * Parses a serialized database, and replaces our contents with it.
+ * The parsing happens outside the lock, directly into a new table,
+ * which then gets swapped in.
+ */
+bool tx_db::load_data(const uint8_t* begin, const uint8_t* end,
+    unsigned threads)
+{
+    // Files in the old watcher format load as nothing, leaving us as-is:
+    if (is_legacy_data(begin, end))
+        return true;
+
+    size_t last_height;
+    row_map rows;
+    arena_list arenas;
+    if (!decode_data(begin, end, threads, last_height, rows, arenas))
+        return false;
+    replace_rows(last_height, rows, arenas);
+    return true;
+}
+
+/**
+ * Returns true if the data is in the old watcher format,
+ * which we can't read.
+ */
+bool tx_db::is_legacy_data(const uint8_t* begin, const uint8_t* end)
+{
+    return 4 <= end - begin &&
+        bc::make_deserializer(begin, end).read_4_bytes() == old_serial_magic;
+}
+
+/**
+ * Parses a serialized database into a new table,
+ * without touching our own contents.
+ */
+bool tx_db::decode_data(const uint8_t* begin, const uint8_t* end,
+    unsigned threads, size_t& last_height, row_map& rows,
+    arena_list& arenas)
+{
+    try
+    {
+        // Header bytes:
+        auto serial = bc::make_deserializer(begin, end);
+        auto magic = serial.read_4_bytes();
+        if (serial_magic == magic)
+        {
+            if (!load_v1(begin, end, last_height, rows))
+                return false;
+        }
+        else if (serial_magic_v2 == magic)
+        {
+            if (!load_v2(begin, end, last_height, rows, threads,
+                use_arenas_ ? &arenas : nullptr))
+                return false;
+        }
+        else
+            return false;
+    }
+    catch (bc::end_of_stream)
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Swaps in a freshly-loaded table, leaving the old one in `rows`.
+ * The new indexes get built before taking the lock, so readers only
+ * wait for the swap. The old table and indexes get freed after the lock
+ * is released. The table's arenas go with it, unless a snapshot still
+ * holds some of the old rows.
+ */
+void tx_db::replace_rows(size_t last_height, row_map& rows,
+    const arena_list& arenas, const spend_list* spends)
+{
+    index_set indexes;
+    build_indexes(rows, indexes, spends);
+
+    write_lock lock(mutex_);
+    last_height_ = last_height;
+    rows_.swap(rows);
+    spends_.swap(indexes.spends);
+    utxos_.swap(indexes.utxos);
+    addresses_.swap(indexes.addresses);
+    heights_.swap(indexes.heights);
+    unsent_.swap(indexes.unsent);
+    unconfirmed_.swap(indexes.unconfirmed);
+    forked_.swap(indexes.forked);
+    forgotten_.clear();
+    arenas_.erase(std::remove_if(arenas_.begin(), arenas_.end(),
+        [](const std::weak_ptr<const tx_arena>& arena)
+        {
+            return arena.expired();
+        }), arenas_.end());
+    arenas_.insert(arenas_.end(), arenas.begin(), arenas.end());
+    changed();
+    loaded_sequence_ = changes_;
+    if (journal_)
+        journal_->write_reload();
+}
+
+/**
+ * Parses the version 1 format, which is a bare sequence of records.
+ */
+bool tx_db::load_v1(const uint8_t* begin, const uint8_t* end,
+    size_t& last_height, row_map& rows)
+{
+    auto serial = bc::make_deserializer(begin + 4, end);
+
+    // Last block height:
+    last_height = serial.read_8_bytes();
+
+    time_t now = time(nullptr);
+    while (serial.iterator() != end)
+    {
+        if (serial.read_byte() != serial_tx)
+            return false;
+
+        bc::hash_digest hash = serial.read_hash();
+        bc::transaction_type tx;
+        bc::satoshi_load(serial.iterator(), end, tx);
+        auto step = serial.iterator() + satoshi_raw_size(tx);
+        serial.set_iterator(step);
+        auto state = static_cast<tx_state>(serial.read_byte());
+        auto height = serial.read_8_bytes();
+        bool need_check = serial.read_byte();
+        rows[hash] = load_row(make_data(tx), state, height,
+            need_check, now);
+    }
+    return true;
+}
+
+/**
+ * Parses the version 2 format. This consists of a header,
+ * a sequence of length-prefixed and checksummed records,
+ * an index of record offsets sorted by hash, and a fixed-size footer
+ * that locates the index.
+ *
+ * Since the records are length-prefixed, we can find their boundaries
+ * without decoding anything, and then hand contiguous ranges of records
+ * off to separate threads.
+ * @param arenas if not null, receives one arena per thread,
+ * which holds the rows that thread decoded.
+ */
+bool tx_db::load_v2(const uint8_t* begin, const uint8_t* end,
+    size_t& last_height, row_map& rows, unsigned threads,
+    arena_list* arenas)
+{
+    const uint8_t* records_end;
+    uint64_t count;
+    if (!check_v2(begin, end, records_end, count))
+        return false;
+
+    // Header:
+    auto serial = bc::make_deserializer(begin + 4, records_end);
+    last_height = serial.read_8_bytes();
+    auto records = serial.iterator();
+
+    // Pick a thread count:
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<uint64_t>(threads, count / load_records_per_thread);
+    if (threads <= 1)
+    {
+        tx_arena_ptr arena;
+        if (arenas)
+        {
+            arena = std::make_shared<tx_arena>();
+            arenas->push_back(arena);
+        }
+        row_vector part;
+        uint64_t height = 0;
+        if (!load_records(records, records_end, part, height, arena))
+            return false;
+        rows.reserve(part.size());
+        for (auto& row: part)
+            rows.insert(std::move(row));
+        return rows.size() == count;
+    }
+
+    // Split the records into ranges with roughly equal record counts:
+    std::vector<const uint8_t*> splits;
+    splits.push_back(records);
+    size_t per_thread = (count + threads - 1) / threads;
+    for (size_t i = 1; serial.iterator() != records_end; ++i)
+    {
+        // The threads check the CRC, but reading it here keeps
+        // a damaged length from walking us off the end:
+        size_t body_size = serial.read_variable_uint();
+        serial.read_4_bytes();
+        auto body = serial.iterator();
+        if (size_t(records_end - body) < body_size)
+            return false;
+        serial.set_iterator(body + body_size);
+        if (0 == i % per_thread && serial.iterator() != records_end)
+            splits.push_back(serial.iterator());
+    }
+    splits.push_back(records_end);
+
+    // Decode each range on its own thread:
+    auto parts = splits.size() - 1;
+    std::vector<row_vector> results(parts);
+    std::vector<uint64_t> heights(parts, 0);
+    std::vector<char> success(parts, false);
+    arena_list part_arenas(parts);
+    if (arenas)
+    {
+        for (auto& arena: part_arenas)
+            arena = std::make_shared<tx_arena>();
+        arenas->insert(arenas->end(), part_arenas.begin(), part_arenas.end());
+    }
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < parts; ++i)
+    {
+        workers.emplace_back([&, i]()
+        {
+            success[i] = load_records(splits[i], splits[i + 1],
+                results[i], heights[i], part_arenas[i]);
+        });
+    }
+    for (auto& worker: workers)
+        worker.join();
+
+    // Each range saw its height deltas starting from zero,
+    // so add in the heights from all the ranges before it:
+    rows.reserve(count);
+    uint64_t base_height = 0;
+    for (size_t i = 0; i < parts; ++i)
+    {
+        if (!success[i])
+            return false;
+        for (auto& row: results[i])
+        {
+            if (tx_state::confirmed == row.second.state)
+                row.second.block_height += base_height;
+            rows.insert(std::move(row));
+        }
+        base_height += heights[i];
+        row_vector().swap(results[i]);
+    }
+    return rows.size() == count;
+}
+
+/**
+ * Checks the framing of a version 2 file: the magic bytes, the footer,
+ * and the bounds and checksum of the index.
+ * @param records_end receives the end of the record section.
+ * @param count receives the number of records.
+ */
+bool tx_db::check_v2(const uint8_t* begin, const uint8_t* end,
+    const uint8_t*& records_end, uint64_t& count)
+{
+    size_t size = end - begin;
+    if (size < serial_header_size + serial_footer_size)
+        return false;
+    if (bc::make_deserializer(begin, end).read_4_bytes() != serial_magic_v2)
+        return false;
+
+    // Footer:
+    auto footer = bc::make_deserializer(end - serial_footer_size, end);
+    uint64_t index_offset = footer.read_8_bytes();
+    count = footer.read_8_bytes();
+    uint32_t index_crc = footer.read_4_bytes();
+    if (footer.read_4_bytes() != serial_footer_magic)
+        return false;
+
+    // Index:
+    size_t index_end = size - serial_footer_size;
+    if (index_offset < serial_header_size || index_end < index_offset ||
+        (index_end - index_offset) / serial_index_entry_size != count ||
+        (index_end - index_offset) % serial_index_entry_size)
+        return false;
+    auto index_size = index_end - index_offset;
+    if (crc32c(begin + index_offset, index_size) != index_crc)
+        return false;
+
+    records_end = begin + index_offset;
+    return true;
+}
+
+/**
+ * Decodes a run of version 2 records. Confirmed heights are accumulated
+ * starting from `height`, which holds the final total on return.
+ * Patches can also contain forgotten rows, which go in `forgotten`.
+ * The row contents go in `arena`, or on the heap if that is null.
+ * This is safe to run on several threads at once,
+ * as long as each has its own arena.
+ */
+bool tx_db::load_records(const uint8_t* begin, const uint8_t* end,
+    row_vector& out, uint64_t& height, const tx_arena_ptr& arena,
+    hash_list* forgotten)
+{
+    try
+    {
+        time_t now = time(nullptr);
+        auto serial = bc::make_deserializer(begin, end);
+        while (serial.iterator() != end)
+        {
+            size_t body_size = serial.read_variable_uint();
+            uint32_t crc = serial.read_4_bytes();
+            auto body = serial.iterator();
+            if (size_t(end - body) < body_size)
+                return false;
+            if (crc32c(body, body_size) != crc)
+                return false;
+            auto body_end = body + body_size;
+
+            bc::hash_digest hash = serial.read_hash();
+            auto state_byte = serial.read_byte();
+            if (serial_state_forgotten == state_byte)
+            {
+                if (!forgotten)
+                    return false;
+                forgotten->push_back(hash);
+                serial.set_iterator(body_end);
+                continue;
+            }
+            auto state = static_cast<tx_state>(state_byte);
+            bool need_check = serial.read_byte();
+            uint64_t row_height = serial.read_variable_uint();
+            if (tx_state::confirmed == state)
+                row_height = height += row_height;
+
+            // Keep the transaction serialized until somebody reads it:
+            auto data = make_raw_data(serial.iterator(), body_end, arena);
+            serial.set_iterator(body_end);
+            out.emplace_back(hash,
+                load_row(std::move(data), state, row_height, need_check, now));
+        }
+    }
+    catch (bc::end_of_stream)
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Builds a row from its saved fields.
+ * Unconfirmed transactions store their timestamp in place of the height.
+ */
+tx_db::tx_row tx_db::load_row(tx_data_ptr data, tx_state state,
+    uint64_t height, bool need_check, time_t now)
+{
+    tx_row row;
+    row.data = std::move(data);
+    row.state = state;
+    row.block_height = height;
+    row.timestamp = now;
+    if (tx_state::unconfirmed == state)
+        row.timestamp = height;
+    row.need_check = need_check;
+    row.sequence = 0;
+    return row;
+}
+
+/**
+ * Picks out the rows worth saving, and puts them in a stable order:
+ * unconfirmed rows first, and then confirmed rows by height,
+ * which keeps the height deltas in the saved file small.
+ * Patches only want the rows that changed at or after `first_sequence`.
+ */
+tx_db::row_list tx_db::save_order(const row_map& rows,
+    unsigned unconfirmed_timeout, uint64_t first_sequence)
+{
+    time_t now = time(nullptr);
+    row_list out;
+    out.reserve(first_sequence ? 0 : rows.size());
+    for (const auto& row: rows)
+        if (first_sequence <= row.second.sequence &&
+            should_save(row.second, now, unconfirmed_timeout))
+            out.push_back(&row);
+    sort_order(out);
+    return out;
+}
+
+/**
+ * Sorts rows into the order save_order describes.
+ */
+void tx_db::sort_order(row_list& order)
+{
+    auto height = [](const row_map::value_type* row) -> size_t
+    {
+        if (tx_state::confirmed != row->second.state)
+            return 0;
+        return row->second.block_height + 1;
+    };
+    std::sort(order.begin(), order.end(),
+        [&height](const row_map::value_type* a, const row_map::value_type* b)
+        {
+            if (height(a) != height(b))
+                return height(a) < height(b);
+            return a->first < b->first;
+        });
+}
+
+/**
+ * Returns the value a row stores in its height field. Confirmed rows
+ * store the difference from the previous confirmed row, and unconfirmed
+ * rows store their timestamp.
+ */
+uint64_t tx_db::height_field(const tx_row& row, uint64_t& previous_height)
+{
+    switch (row.state)
+    {
+    case tx_state::confirmed:
+    {
+        uint64_t delta = row.block_height - previous_height;
+        previous_height = row.block_height;
+        return delta;
+    }
+    case tx_state::unconfirmed:
+        return row.timestamp;
+    default:
+        return row.block_height;
+    }
+}
+
+/**
+ * Returns the exact number of bytes write_rows will produce.
+ */
+size_t tx_db::serialized_size(const row_list& order)
+{
+    size_t size = serial_header_size;
+    uint64_t previous_height = 0;
+    for (auto row: order)
+    {
+        auto height = height_field(row->second, previous_height);
+        size += record_size(height, row->second.data->raw_size);
+    }
+    size += order.size() * serial_index_entry_size;
+    return size + serial_footer_size;
+}
+
+/**
+ * Serializes rows in the version 2 format, a chunk at a time.
+ */
+bool tx_db::write_rows(size_t last_height, const row_list& order,
+    const sink_fn& sink, unsigned threads)
+{
+    // Work out each record's height field, and where it goes in the file.
+    // This lets separate threads encode separate stretches of records:
+    std::vector<uint64_t> heights;
+    std::vector<uint64_t> offsets;
+    heights.reserve(order.size());
+    offsets.reserve(order.size() + 1);
+    offsets.push_back(serial_header_size);
+    uint64_t previous_height = 0;
+    for (auto row: order)
+    {
+        heights.push_back(height_field(row->second, previous_height));
+        offsets.push_back(offsets.back() +
+            record_size(heights.back(), row->second.data->raw_size));
+    }
+
+    // Header:
+    uint8_t header[serial_header_size];
+    auto serial = bc::make_serializer(header);
+    serial.write_4_bytes(serial_magic_v2);
+    serial.write_8_bytes(last_height);
+    if (!sink(header, serial_header_size))
+        return false;
+
+    // Records, a round at a time. Each thread in a round encodes a
+    // contiguous run of records into its own buffer, and then the
+    // buffers go to the sink in file order:
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<bc::data_chunk> buffers(threads);
+    for (size_t next = 0; next < order.size(); )
+    {
+        typedef std::pair<size_t, size_t> run;
+        std::vector<run> runs;
+        for (unsigned i = 0; i < threads && next < order.size(); ++i)
+        {
+            size_t end = next + 1;
+            while (end < order.size() &&
+                offsets[end + 1] - offsets[next] <= serial_run_size)
+                ++end;
+            runs.push_back(run(next, end));
+            next = end;
+        }
+
+        auto encode = [&](size_t i)
+        {
+            auto& buffer = buffers[i];
+            buffer.resize(offsets[runs[i].second] - offsets[runs[i].first]);
+            auto out = buffer.data();
+            for (size_t j = runs[i].first; j < runs[i].second; ++j)
+            {
+                const auto& row = *order[j];
+                const auto& data = *row.second.data;
+                out = write_record(out, row.first,
+                    static_cast<uint8_t>(row.second.state),
+                    row.second.need_check, heights[j], data.raw_size,
+                    [&data](uint8_t* at)
+                    {
+                        return data.write_raw(at);
+                    });
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < runs.size(); ++i)
+            workers.emplace_back(encode, i);
+        encode(0);
+        for (auto& worker: workers)
+            worker.join();
+
+        for (size_t i = 0; i < runs.size(); ++i)
+            if (!sink(buffers[i].data(), buffers[i].size()))
+                return false;
+    }
+    std::vector<bc::data_chunk>().swap(buffers);
+
+    // Index, sorted by hash so readers can binary-search it:
+    typedef std::pair<bc::hash_digest, uint64_t> index_entry;
+    std::vector<index_entry> index;
+    index.reserve(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        index.push_back(index_entry(order[i]->first, offsets[i]));
+    std::sort(index.begin(), index.end());
+
+    chunk_writer out(sink);
+    uint64_t index_offset = offsets.back();
+    uint32_t index_crc = 0;
+    for (const auto& entry: index)
+    {
+        auto data = out.take(serial_index_entry_size);
+        auto serial = bc::make_serializer(data);
+        serial.write_hash(entry.first);
+        serial.write_8_bytes(entry.second);
+        index_crc = crc32c(index_crc, data, serial_index_entry_size);
+    }
+
+    // Footer:
+    auto footer = bc::make_serializer(out.take(serial_footer_size));
+    footer.write_8_bytes(index_offset);
+    footer.write_8_bytes(index.size());
+    footer.write_4_bytes(index_crc);
+    footer.write_4_bytes(serial_footer_magic);
+    return out.flush();
+}
+
+/**
+ * Returns false for old unconfirmed transactions, which we don't save.
+ */
+bool tx_db::should_save(const tx_row& row, time_t now,
+    unsigned unconfirmed_timeout)
+{
+    return tx_state::confirmed == row.state ||
+        now <= row.timestamp + unconfirmed_timeout;
+}
+
+/**
+ * Adds a brand-new row to the table and the indexes.
+ */
+void tx_db::insert_row(const bc::hash_digest& tx_hash, tx_data_ptr data,
+    tx_state state, time_t timestamp)
+{
+    auto& row = rows_[tx_hash];
+    row = tx_row{std::move(data), state, 0, timestamp, false, 0};
+    forgotten_.erase(tx_hash);
+    index_tx(tx_hash, row);
+    index_state(tx_hash, row);
+    changed(row);
+    if (journal_)
+        journal_->write_insert(*row.data, state, timestamp);
+}
+
+/**
+ * Packages a transaction for storage in a row.
+ */
+tx_db::tx_data_ptr tx_db::make_data(const bc::transaction_type& tx)
+{
+    bc::data_chunk raw(satoshi_raw_size(tx));
+    satoshi_save(tx, raw.begin());
+    return make_raw_data(raw.data(), raw.data() + raw.size(), nullptr);
+}
+
+/**
+ * Packages a serialized transaction for storage in a row.
+ * This walks the raw bytes to find where each input and output starts,
+ * but doesn't build a transaction object. The output scripts go in
+ * the script pool, and the rest goes in the row's buffer.
+ * Throws end_of_stream if the transaction is malformed. A script that
+ * is merely unparseable doesn't count, and gets an invalid address
+ * in the address table.
+ * @param arena holds the row's buffer, or null to use the heap.
+ */
+tx_db::tx_data_ptr tx_db::make_raw_data(const uint8_t* begin,
+    const uint8_t* end, const tx_arena_ptr& arena)
+{
+    // We don't know how many inputs and outputs there are until the walk
+    // is done, so their positions collect here first. Reusing the space
+    // keeps loading from allocating twice per row:
+    typedef std::pair<const uint8_t*, const uint8_t*> script_range;
+    static thread_local std::vector<uint32_t> offsets;
+    static thread_local std::vector<script_range> scripts;
+    static thread_local std::vector<bc::payment_address> addresses;
+    offsets.clear();
+    scripts.clear();
+    addresses.clear();
+
+    if (0xffffffff < size_t(end - begin))
+        throw bc::end_of_stream();
+    auto serial = bc::make_deserializer(begin, end);
+    auto skip_script = [&serial, end]()
+    {
+        size_t size = serial.read_variable_uint();
+        auto script = serial.iterator();
+        if (size_t(end - script) < size)
+            throw bc::end_of_stream();
+        serial.set_iterator(script + size);
+        return script_range(script, script + size);
+    };
+
+    // Version:
+    serial.read_4_bytes();
+
+    // Inputs:
+    size_t input_count = serial.read_variable_uint();
+    for (size_t i = 0; i < input_count; ++i)
+    {
+        offsets.push_back(serial.iterator() - begin);
+        auto previous_hash = serial.read_hash();
+        serial.read_4_bytes();
+        auto script = skip_script();
+        serial.read_4_bytes();
+
+        // Coinbase scripts are raw data, and don't parse. Other scripts
+        // that don't parse get an invalid address from raw_script_address:
+        if (bc::null_hash == previous_hash)
+            addresses.push_back(bc::payment_address());
+        else
+            addresses.push_back(raw_script_address(
+                bc::data_slice(script.first, script.second)));
+    }
+
+    // Outputs. Their offsets are into the buffer, which is missing
+    // the scripts of the outputs before them:
+    size_t output_count = serial.read_variable_uint();
+    size_t removed = 0;
+    for (size_t i = 0; i < output_count; ++i)
+    {
+        offsets.push_back(serial.iterator() - begin - removed);
+        serial.read_8_bytes();
+        scripts.push_back(skip_script());
+        removed += scripts.back().second - scripts.back().first;
+        addresses.push_back(raw_script_address(
+            bc::data_slice(scripts.back().first, scripts.back().second)));
+    }
+
+    // Locktime:
+    serial.read_4_bytes();
+    if (serial.iterator() != end)
+        throw bc::end_of_stream();
+
+    // Copy everything but the output scripts into the buffer:
+    auto data = std::make_shared<tx_data>(arena, scripts_);
+    data->raw_size = static_cast<uint32_t>(end - begin);
+    data->stripped_size = static_cast<uint32_t>(end - begin - removed);
+    data->input_count = static_cast<uint32_t>(input_count);
+    data->buffer.resize(data->stripped_size + 4 * offsets.size() +
+        sizeof(const script_pool::entry*) * scripts.size() +
+        address_size * addresses.size());
+    auto out = data->buffer.data();
+    auto copied = begin;
+    for (const auto& script: scripts)
+    {
+        out = std::copy(copied, script.first, out);
+        copied = script.second;
+    }
+    out = std::copy(copied, end, out);
+    if (!offsets.empty())
+        std::memcpy(out, offsets.data(), 4 * offsets.size());
+    out += 4 * offsets.size();
+    auto pointers = out;
+    out += sizeof(const script_pool::entry*) * scripts.size();
+    for (const auto& address: addresses)
+        out = write_address(out, address);
+
+    // Setting the count last means the destructor only releases
+    // the scripts that were actually interned:
+    for (const auto& script: scripts)
+    {
+        auto pooled = scripts_->intern(script.first, script.second);
+        std::memcpy(pointers, &pooled, sizeof(pooled));
+        pointers += sizeof(pooled);
+    }
+    data->output_count = static_cast<uint32_t>(output_count);
+    return data;
+}
+
+tx_db::tx_data::tx_data(tx_arena_ptr arena, script_pool_ptr pool)
+  : arena(std::move(arena)),
+    pool(std::move(pool)),
+    buffer(arena_allocator<uint8_t>(this->arena.get())),
+    raw_size(0),
+    stripped_size(0),
+    input_count(0),
+    output_count(0)
+{
+}
+
+tx_db::tx_data::~tx_data()
+{
+    for (size_t i = 0; i < output_count; ++i)
+        pool->release(output(i).pooled);
+}
+
+const bc::transaction_type& tx_db::tx_data::tx() const
+{
+    std::call_once(decoded, [this]()
+    {
+        decoded_tx.reset(new bc::transaction_type());
+        auto data = raw();
+        bc::satoshi_load(data.begin(), data.end(), *decoded_tx);
+    });
+    return *decoded_tx;
+}
+
+uint8_t* tx_db::tx_data::write_raw(uint8_t* out) const
+{
+    // Put each output's script back after its length prefix:
+    auto stripped = buffer.data();
+    auto copied = stripped;
+    for (size_t i = 0; i < output_count; ++i)
+    {
+        auto view = output(i);
+        auto script = view.begin + 8 + prefix_size(view.begin[8]);
+        out = std::copy(copied, script, out);
+        out = std::copy(view.pooled->data(),
+            view.pooled->data() + view.pooled->size, out);
+        copied = script;
+    }
+    return std::copy(copied, stripped + stripped_size, out);
+}
+
+bc::data_chunk tx_db::tx_data::raw() const
+{
+    bc::data_chunk out(raw_size);
+    write_raw(out.data());
+    return out;
+}
+
+tx_db::input_view tx_db::tx_data::input(size_t i) const
+{
+    auto begin = buffer.data();
+    auto table = begin + stripped_size;
+    auto addresses = table + 4 * (input_count + output_count) +
+        sizeof(const script_pool::entry*) * output_count;
+    return input_view{begin + offset_at(table + 4 * i),
+        begin + stripped_size, addresses + address_size * i};
+}
+
+tx_db::output_view tx_db::tx_data::output(size_t i) const
+{
+    auto begin = buffer.data();
+    auto table = begin + stripped_size + 4 * input_count;
+    auto pointers = table + 4 * output_count;
+    auto addresses = pointers + sizeof(const script_pool::entry*) *
+        output_count + address_size * input_count;
+    const script_pool::entry* pooled;
+    std::memcpy(&pooled, pointers + sizeof(pooled) * i, sizeof(pooled));
+    return output_view{begin + offset_at(table + 4 * i),
+        begin + stripped_size, pooled, addresses + address_size * i};
+}
+
+bc::output_point tx_db::input_view::previous_output() const
+{
+    auto serial = bc::make_deserializer(begin, end);
+    bc::output_point out;
+    out.hash = serial.read_hash();
+    out.index = serial.read_4_bytes();
+    return out;
+}
+
+bc::data_slice tx_db::input_view::script() const
+{
+    return script_at(begin + 32 + 4, end);
+}
+
+bc::payment_address tx_db::input_view::address() const
+{
+    return read_address(address_bytes);
+}
+
+uint64_t tx_db::output_view::value() const
+{
+    return bc::make_deserializer(begin, end).read_8_bytes();
+}
+
+bc::data_slice tx_db::output_view::script() const
+{
+    return bc::data_slice(pooled->data(), pooled->data() + pooled->size);
+}
+
+bc::payment_address tx_db::output_view::address() const
+{
+    return read_address(address_bytes);
+}
+
+/**
+ * Call this with the write lock held whenever the database changes.
+ */
+void tx_db::changed()
+{
+    snapshot_.reset();
+    ++changes_;
+}
+
+/**
+ * Like changed(), but also marks a row as needing to go in the next patch.
+ */
+void tx_db::changed(tx_row& row)
+{
+    changed();
+    row.sequence = changes_;
+}
+
+/**
+ * Removes a row from the table and the indexes,
+ * leaving a tombstone behind for the next patch.
+ */
+void tx_db::erase_row(row_map::const_iterator i)
+{
+    auto tx_hash = i->first;
+    unindex_tx(tx_hash, i->second);
+    unindex_state(tx_hash, i->second);
+    changed();
+    forgotten_[tx_hash] = changes_;
+    rows_.erase(tx_hash);
+}
+
+/**
+ * Drops the tombstones for rows forgotten before a full save,
+ * since patches against that save will never need them.
+ */
+void tx_db::prune_forgotten(uint64_t sequence)
+{
+    write_lock lock(mutex_);
+    for (auto i = forgotten_.begin(); i != forgotten_.end(); )
+    {
+        if (i->second <= sequence)
+            i = forgotten_.erase(i);
+        else
+            ++i;
+    }
+}
+
+/**
+ * Returns the current snapshot, creating one if needed.
+ * Copying the chunked tables only copies their chunk pointers, so this
+ * costs the same no matter how big the database is. The first change to
+ * each chunk afterwards pays for cloning that chunk.
+ * The caller must hold either the read or the write lock.
+ */
+tx_snapshot tx_db::make_snapshot()
+{
+    return tx_snapshot(tx_snapshot::part_list{snapshot_part()});
+}
+
+/**
+ * Returns the current snapshot's tables, creating them if needed.
+ * The caller must hold either the read or the write lock.
+ */
+std::shared_ptr<const tx_db::snapshot_data> tx_db::snapshot_part()
+{
+    std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+
+    auto data = snapshot_.lock();
+    if (!data)
+    {
+        auto fresh = std::make_shared<snapshot_data>();
+        fresh->last_height = last_height_;
+        fresh->unconfirmed_timeout = unconfirmed_timeout_;
+        fresh->rows = rows_;
+        fresh->utxos = utxos_;
+        data = fresh;
+        snapshot_ = data;
+    }
+    return data;
+}
+
+/**
+ * Restores a row's timestamp when replaying a journal.
+ */
+void tx_db::set_timestamp(bc::hash_digest tx_hash, time_t timestamp)
+{
+    write_lock lock(mutex_);
+
+    auto row = rows_.modify(tx_hash);
+    if (row)
+    {
+        row->timestamp = timestamp;
+        changed(*row);
+    }
+}
+
+/**
+ * Adds a transaction to the spend, utxo and address indexes.
+ * The transaction must already be present in the rows_ table.
+ */
+void tx_db::index_tx(const bc::hash_digest& tx_hash, const tx_row& row)
+{
+    const auto& data = *row.data;
+
+    // The outputs this transaction consumes are no longer unspent.
+    // Shards leave this to the shard holding each output:
+    if (!sharded_)
+        for (size_t i = 0; i < data.input_count; ++i)
+            index_spend(data.input(i).previous_output(), tx_hash);
+
+    // Our own outputs are unspent unless something already spends them:
+    for (uint32_t i = 0; i < data.output_count; ++i)
+    {
+        auto output = data.output(i);
+        bc::output_point point = {tx_hash, i};
+        if (spends_.find(point) == spends_.end())
+            utxos_[point] = output.value();
+
+        auto address = output.address();
+        if (is_standard(address))
+            addresses_.emplace(address, point);
+    }
+}
+
+/**
+ * Removes a transaction from the spend, utxo and address indexes.
+ * The transaction must still be present in the rows_ table.
+ */
+void tx_db::unindex_tx(const bc::hash_digest& tx_hash, const tx_row& row)
+{
+    const auto& data = *row.data;
+
+    for (uint32_t i = 0; i < data.output_count; ++i)
+    {
+        bc::output_point point = {tx_hash, i};
+        utxos_.erase(point);
+
+        auto address = data.output(i).address();
+        if (!is_standard(address))
+            continue;
+        auto range = addresses_.equal_range(address);
+        for (auto j = range.first; j != range.second; ++j)
+        {
+            if (j->second == point)
+            {
+                addresses_.erase(j);
+                break;
+            }
+        }
+    }
+
+    if (!sharded_)
+        for (size_t i = 0; i < data.input_count; ++i)
+            unindex_spend(data.input(i).previous_output(), tx_hash);
+}
+
+/**
+ * Records that a transaction spends an output.
+ */
+void tx_db::index_spend(const bc::output_point& point,
+    const bc::hash_digest& spender)
+{
+    spends_.emplace(point, spender);
+    utxos_.erase(point);
+}
+
+/**
+ * Removes the record that a transaction spends an output,
+ * restoring the output if nothing else spends it.
+ */
+void tx_db::unindex_spend(const bc::output_point& point,
+    const bc::hash_digest& spender)
+{
+    auto range = spends_.equal_range(point);
+    for (auto i = range.first; i != range.second; ++i)
+    {
+        if (i->second == spender)
+        {
+            spends_.erase(i);
+            break;
+        }
+    }
+
+    if (spends_.find(point) != spends_.end())
+        return;
+    auto j = rows_.find(point.hash);
+    if (j == rows_.end())
+        return;
+    const auto& spent = *j->second.data;
+    if (point.index < spent.output_count)
+        utxos_[point] = spent.output(point.index).value();
+}
+
+/**
+ * Records spends of our outputs by transactions in other shards.
+ */
+void tx_db::add_spends(const spend_list& spends)
+{
+    write_lock lock(mutex_);
+    for (const auto& spend: spends)
+        index_spend(spend.first, spend.second);
+    changed();
+}
+
+/**
+ * Drops spends of our outputs by transactions that other shards forgot.
+ */
+void tx_db::remove_spends(const spend_list& spends)
+{
+    write_lock lock(mutex_);
+    for (const auto& spend: spends)
+        unindex_spend(spend.first, spend.second);
+    changed();
+}
+
+/**
+ * Adds a transaction to the indexes that depend on its state.
+ * Call this after changing a row's state or height.
+ */
+void tx_db::index_state(const bc::hash_digest& tx_hash, const tx_row& row)
+{
+    switch (row.state)
+    {
+    case tx_state::unsent:
+        unsent_.insert(tx_hash);
+        break;
+    case tx_state::unconfirmed:
+        unconfirmed_.insert(tx_hash);
+        break;
+    case tx_state::confirmed:
+        heights_[row.block_height].insert(tx_hash);
+        if (row.need_check)
+            forked_.insert(tx_hash);
+        break;
+    }
+}
+
+/**
+ * Removes a transaction from the indexes that depend on its state.
+ * Call this before changing a row's state or height.
+ */
+void tx_db::unindex_state(const bc::hash_digest& tx_hash, const tx_row& row)
+{
+    switch (row.state)
+    {
+    case tx_state::unsent:
+        unsent_.erase(tx_hash);
+        return;
+    case tx_state::unconfirmed:
+        unconfirmed_.erase(tx_hash);
+        return;
+    case tx_state::confirmed:
+        forked_.erase(tx_hash);
+        break;
+    }
+
+    auto level = heights_.find(row.block_height);
+    if (level == heights_.end())
+        return;
+    level->second.erase(tx_hash);
+    if (level->second.empty())
+        heights_.erase(level);
+}
+
+/**
+ * Computes all the secondary indexes for a table from scratch.
+ * The indexes are independent of each other, apart from the utxo index
+ * needing the spend index, so they get built on separate threads.
+ * This only reads the table, so it needs no lock if nobody else can
+ * see the table yet.
+ * @param spends the spends to index in place of the table's own inputs,
+ * which shards use, or null.
+ */
+void tx_db::build_indexes(const row_map& rows, index_set& out,
+    const spend_list* spends)
+{
+    std::thread spend_thread([&rows, &out, spends]()
+    {
+        if (spends)
+        {
+            out.spends.reserve(spends->size());
+            for (const auto& spend: *spends)
+                out.spends.emplace(spend.first, spend.second);
+        }
+        else
+        {
+            out.spends.reserve(rows.size());
+            for (const auto& row: rows)
+            {
+                const auto& data = *row.second.data;
+                for (size_t i = 0; i < data.input_count; ++i)
+                    out.spends.emplace(data.input(i).previous_output(),
+                        row.first);
+            }
+        }
+
+        // Outputs are unspent unless something in the table spends them:
+        for (const auto& row: rows)
+        {
+            const auto& data = *row.second.data;
+            for (uint32_t i = 0; i < data.output_count; ++i)
+            {
+                bc::output_point point = {row.first, i};
+                if (out.spends.find(point) == out.spends.end())
+                    out.utxos[point] = data.output(i).value();
+            }
+        }
+    });
+
+    std::thread address_thread([&rows, &out]()
+    {
+        for (const auto& row: rows)
+        {
+            const auto& data = *row.second.data;
+            for (uint32_t i = 0; i < data.output_count; ++i)
+            {
+                auto address = data.output(i).address();
+                if (is_standard(address))
+                    out.addresses.emplace(address,
+                        bc::output_point{row.first, i});
+            }
+        }
+    });
+
+    for (const auto& row: rows)
+    {
+        switch (row.second.state)
+        {
+        case tx_state::unsent:
+            out.unsent.insert(row.first);
+            break;
+        case tx_state::unconfirmed:
+            out.unconfirmed.insert(row.first);
+            break;
+        case tx_state::confirmed:
+            out.heights[row.second.block_height].insert(row.first);
+            if (row.second.need_check)
+                out.forked.insert(row.first);
+            break;
+        }
+    }
+
+    spend_thread.join();
+    address_thread.join();
+}
+
+/**
+ * Picks the shard for a transaction from the last bytes of its hash,
+ * which nothing else hashes on.
+ */
+size_t tx_db::shard_index(const bc::hash_digest& tx_hash, size_t shards)
+{
+    uint32_t bits;
+    std::memcpy(&bits, tx_hash.data() + tx_hash.size() - sizeof(bits),
+        sizeof(bits));
+    return bits % shards;
+}
+
+size_t tx_db::point_hash::operator()(const bc::output_point& point) const
+{
+    // Transaction hashes are already random, so a slice is good enough:
+    size_t out;
+    std::copy(point.hash.begin(), point.hash.begin() + sizeof(out),
+        reinterpret_cast<uint8_t*>(&out));
+    return out ^ point.index;
+}
+
+tx_snapshot::tx_snapshot(part_list parts)
+  : parts_(std::move(parts))
+{
+}
+
+size_t tx_snapshot::last_height() const
+{
+    size_t out = 0;
+    for (const auto& part: parts_)
+        out = std::max(out, part->last_height);
+    return out;
+}
+
+bool tx_snapshot::has_tx(bc::hash_digest tx_hash) const
+{
+    const auto& rows = part_for(tx_hash).rows;
+    return rows.find(tx_hash) != rows.end();
+}
+
+tx_ptr tx_snapshot::get_tx(bc::hash_digest tx_hash) const
+{
+    const auto& rows = part_for(tx_hash).rows;
+    auto i = rows.find(tx_hash);
+    if (i == rows.end())
+        return nullptr;
+    const auto& row_data = i->second.data;
+    return tx_ptr(row_data, &row_data->tx());
+}
+
+size_t tx_snapshot::get_tx_height(bc::hash_digest tx_hash) const
+{
+    const auto& rows = part_for(tx_hash).rows;
+    auto i = rows.find(tx_hash);
+    if (i == rows.end())
+        return 0;
+    if (i->second.state != tx_state::confirmed)
+        return 0;
+    return i->second.block_height;
+}
+
+bc::output_info_list tx_snapshot::get_utxos() const
+{
+    size_t size = 0;
+    for (const auto& part: parts_)
+        size += part->utxos.size();
+
+    bc::output_info_list out;
+    out.reserve(size);
+    for (const auto& part: parts_)
+    {
+        for (auto& utxo: part->utxos)
+        {
+            bc::output_info_type info = {utxo.first, utxo.second};
+            out.push_back(info);
+        }
+    }
+    return out;
+}
+
+bc::output_info_list tx_snapshot::get_utxos(const address_set& addresses) const
+{
+    // Each part's utxos are outputs of that part's own transactions:
+    bc::output_info_list out;
+    for (const auto& part: parts_)
+    {
+        for (auto& utxo: part->utxos)
+        {
+            auto i = part->rows.find(utxo.first.hash);
+            BITCOIN_ASSERT(i != part->rows.end());
+            auto address = i->second.data->output(utxo.first.index).address();
+            if (addresses.find(address) != addresses.end())
+            {
+                bc::output_info_type info = {utxo.first, utxo.second};
+                out.push_back(info);
+            }
+        }
+    }
+    return out;
+}
+
+bool tx_snapshot::serialize_to(const tx_db::sink_fn& sink,
+    unsigned threads) const
+{
+    tx_db::row_list order;
+    for (const auto& part: parts_)
+    {
+        auto rows = tx_db::save_order(part->rows, part->unconfirmed_timeout);
+        order.insert(order.end(), rows.begin(), rows.end());
+    }
+    if (1 < parts_.size())
+        tx_db::sort_order(order);
+    return tx_db::write_rows(last_height(), order, sink, threads);
+}
+
+/**
+ * Finds the part holding a transaction, the same way the sharded
+ * database picks a shard.
+ */
+const tx_db::snapshot_data& tx_snapshot::part_for(
+    const bc::hash_digest& tx_hash) const
+{
+    return *parts_[tx_db::shard_index(tx_hash, parts_.size())];
 }
 
 } // libwallet
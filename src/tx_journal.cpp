@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <bitcoin/watcher/tx_journal.hpp>
+#include "crc32c.hpp"
+#include "file_util.hpp"
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+namespace libwallet {
+
+// Journal file format:
+constexpr uint32_t journal_magic = 0x8a2c5e18;
+constexpr size_t journal_header_size = 4;
+
+// Each record is a type byte, a 4-byte payload size, the payload,
+// and a 4-byte CRC-32C covering everything before it:
+constexpr size_t record_overhead = 1 + 4 + 4;
+
+enum journal_record : uint8_t
+{
+    record_insert = 1,
+    record_confirmed,
+    record_unconfirmed,
+    record_forget,
+    record_height,
+    record_timestamp
+};
+
+BC_API tx_journal::~tx_journal()
+{
+    close();
+}
+
+BC_API tx_journal::tx_journal(tx_db& db, const std::string& path,
+    size_t compact_size)
+  : db_(db),
+    path_(path),
+    journal_path_(path + ".journal"),
+    old_path_(path + ".journal.old"),
+    compact_size_(compact_size),
+    fd_(-1),
+    size_(0),
+    compacting_(false),
+    compact_again_(false),
+    failed_(false)
+{
+}
+
+bool tx_journal::open()
+{
+    // Start from the last snapshot, if there is one:
+    if (file_exists(path_) && !db_.load_file(path_))
+        return false;
+
+    // Replay any changes made since then. A journal that a compaction
+    // was in the middle of folding away comes first. Replaying changes
+    // that already made it into the snapshot is harmless, since every
+    // record sets state rather than adjusting it:
+    bool replayed = false;
+    if (!replay(old_path_, replayed) || !replay(journal_path_, replayed))
+        return false;
+
+    // Fold the replayed changes into a fresh snapshot,
+    // so we can start over with an empty journal:
+    if (replayed)
+    {
+        auto write = [this](const tx_db::sink_fn& sink)
+        {
+            return db_.serialize_to(sink);
+        };
+        if (!replace_file(path_, write))
+            return false;
+    }
+    unlink(old_path_.c_str());
+
+    tx_db::write_lock lock(db_.mutex_);
+    if (!open_journal())
+        return false;
+    db_.journal_ = this;
+    return true;
+}
+
+void tx_journal::close()
+{
+    {
+        tx_db::write_lock lock(db_.mutex_);
+        if (this == db_.journal_)
+            db_.journal_ = nullptr;
+        if (0 <= fd_)
+        {
+            fsync(fd_);
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    if (compactor_.joinable())
+        compactor_.join();
+}
+
+bool tx_journal::sync()
+{
+    tx_db::write_lock lock(db_.mutex_);
+    return 0 <= fd_ && !fdatasync(fd_);
+}
+
+bool tx_journal::compact()
+{
+    tx_db::write_lock lock(db_.mutex_);
+    if (this != db_.journal_)
+        return false;
+    start_compaction();
+    return true;
+}
+
+bool tx_journal::good()
+{
+    return !failed_;
+}
+
+void tx_journal::write_insert(const tx_db::tx_data& data, tx_state state,
+    time_t timestamp)
+{
+    auto serial = bc::make_serializer(
+        begin_record(record_insert, 1 + 8 + data.raw_size));
+    serial.write_byte(static_cast<uint8_t>(state));
+    serial.write_8_bytes(timestamp);
+    data.write_raw(serial.iterator());
+    append();
+}
+
+void tx_journal::write_confirmed(const bc::hash_digest& tx_hash,
+    size_t block_height)
+{
+    auto serial = bc::make_serializer(begin_record(record_confirmed, 32 + 8));
+    serial.write_hash(tx_hash);
+    serial.write_8_bytes(block_height);
+    append();
+}
+
+void tx_journal::write_unconfirmed(const bc::hash_digest& tx_hash)
+{
+    auto serial = bc::make_serializer(begin_record(record_unconfirmed, 32));
+    serial.write_hash(tx_hash);
+    append();
+}
+
+void tx_journal::write_forget(const bc::hash_digest& tx_hash)
+{
+    auto serial = bc::make_serializer(begin_record(record_forget, 32));
+    serial.write_hash(tx_hash);
+    append();
+}
+
+void tx_journal::write_height(size_t height)
+{
+    auto serial = bc::make_serializer(begin_record(record_height, 8));
+    serial.write_8_bytes(height);
+    append();
+}
+
+void tx_journal::write_timestamp(const bc::hash_digest& tx_hash,
+    time_t timestamp)
+{
+    auto serial = bc::make_serializer(begin_record(record_timestamp, 32 + 8));
+    serial.write_hash(tx_hash);
+    serial.write_8_bytes(timestamp);
+    append();
+}
+
+void tx_journal::write_reload()
+{
+    start_compaction();
+}
+
+/**
+ * Lays out the header of a new record in the reusable record buffer.
+ * @return where the payload goes.
+ */
+uint8_t* tx_journal::begin_record(uint8_t type, size_t size)
+{
+    record_.resize(record_overhead + size);
+    auto serial = bc::make_serializer(record_.begin());
+    serial.write_byte(type);
+    serial.write_4_bytes(size);
+    return record_.data() + 1 + 4;
+}
+
+/**
+ * Checksums the record in the record buffer and adds it to the end
+ * of the journal, kicking off a compaction if the journal has grown
+ * too large.
+ */
+void tx_journal::append()
+{
+    if (fd_ < 0)
+        return;
+
+    auto body_size = record_.size() - 4;
+    auto serial = bc::make_serializer(record_.begin() + body_size);
+    serial.write_4_bytes(crc32c(record_.data(), body_size));
+
+    if (!write_all(fd_, record_.data(), record_.size()))
+    {
+        // Replay stops at the first torn record, so nothing we append
+        // after this would ever come back. The snapshot a compaction
+        // takes already holds this change, so fold everything into
+        // that and start over with a fresh journal:
+        failed_ = true;
+        ::close(fd_);
+        fd_ = -1;
+        start_compaction();
+        return;
+    }
+    size_ += record_.size();
+
+    if (compact_size_ && compact_size_ <= size_)
+        start_compaction();
+}
+
+/**
+ * Applies the records in a journal file to the database.
+ * Reading stops quietly at the first torn or corrupt record,
+ * since that is where a crash interrupted the journal.
+ */
+bool tx_journal::replay(const std::string& path, bool& replayed)
+{
+    if (!file_exists(path))
+        return true;
+    bc::data_chunk data;
+    if (!read_file(path, data))
+        return false;
+
+    try
+    {
+        const uint8_t* begin = data.data();
+        const uint8_t* end = begin + data.size();
+        auto serial = bc::make_deserializer(begin, end);
+        auto magic = serial.read_4_bytes();
+        if (magic != journal_magic)
+            return false;
+
+        while (record_overhead <= size_t(end - serial.iterator()))
+        {
+            auto start = serial.iterator();
+            auto type = serial.read_byte();
+            size_t size = serial.read_4_bytes();
+            if (size_t(end - serial.iterator()) < size + 4)
+                break;
+            auto payload = serial.iterator();
+            serial.set_iterator(payload + size);
+            auto body_size = serial.iterator() - start;
+            if (serial.read_4_bytes() != crc32c(start, body_size))
+                break;
+
+            apply(type, payload, payload + size);
+            replayed = true;
+        }
+    }
+    catch (bc::end_of_stream)
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Makes the change described by a single journal record.
+ */
+void tx_journal::apply(uint8_t type, const uint8_t* begin,
+    const uint8_t* end)
+{
+    auto serial = bc::make_deserializer(begin, end);
+    switch (type)
+    {
+    case record_insert:
+    {
+        auto state = static_cast<tx_state>(serial.read_byte());
+        time_t timestamp = serial.read_8_bytes();
+        bc::transaction_type tx;
+        bc::satoshi_load(serial.iterator(), end, tx);
+        db_.insert(tx, state);
+        db_.set_timestamp(bc::hash_transaction(tx), timestamp);
+        break;
+    }
+    case record_confirmed:
+    {
+        auto tx_hash = serial.read_hash();
+        size_t block_height = serial.read_8_bytes();
+        if (db_.has_tx(tx_hash))
+            db_.confirmed(tx_hash, block_height);
+        break;
+    }
+    case record_unconfirmed:
+    {
+        auto tx_hash = serial.read_hash();
+        if (db_.has_tx(tx_hash))
+            db_.unconfirmed(tx_hash);
+        break;
+    }
+    case record_forget:
+        db_.forget(serial.read_hash());
+        break;
+    case record_height:
+        db_.at_height(serial.read_8_bytes());
+        break;
+    case record_timestamp:
+    {
+        auto tx_hash = serial.read_hash();
+        time_t timestamp = serial.read_8_bytes();
+        db_.set_timestamp(tx_hash, timestamp);
+        break;
+    }
+    default:
+        // Skip records from newer versions of this library:
+        break;
+    }
+}
+
+/**
+ * Starts a fresh, empty journal file.
+ */
+bool tx_journal::open_journal()
+{
+    fd_ = ::open(journal_path_.c_str(),
+        O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd_ < 0)
+        return false;
+
+    bc::data_chunk header(journal_header_size);
+    auto serial = bc::make_serializer(header.begin());
+    serial.write_4_bytes(journal_magic);
+    if (!write_all(fd_, header.data(), header.size()))
+    {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    size_ = header.size();
+    return true;
+}
+
+/**
+ * Moves the current journal out of the way, so a compaction can fold
+ * it into the snapshot, and starts a new one for further changes.
+ */
+bool tx_journal::rotate()
+{
+    ::close(fd_);
+    fd_ = -1;
+
+    if (file_exists(old_path_))
+    {
+        // A previous compaction failed, so its journal is still waiting.
+        // Tack our records onto the end of it:
+        bc::data_chunk data;
+        if (!read_file(journal_path_, data))
+            return false;
+        int fd = ::open(old_path_.c_str(), O_WRONLY | O_APPEND);
+        if (fd < 0)
+            return false;
+        bool success = journal_header_size <= data.size() &&
+            write_all(fd, data.data() + journal_header_size,
+                data.size() - journal_header_size) && !fsync(fd);
+        ::close(fd);
+        if (!success)
+            return false;
+    }
+    else if (rename(journal_path_.c_str(), old_path_.c_str()) < 0)
+        return false;
+
+    return open_journal();
+}
+
+/**
+ * Captures the database and rotates the journal, both at the same instant,
+ * and then writes the snapshot out on a background thread.
+ */
+void tx_journal::start_compaction()
+{
+    if (compacting_)
+    {
+        compact_again_ = true;
+        return;
+    }
+    if (compactor_.joinable())
+        compactor_.join();
+
+    auto snapshot = db_.make_snapshot();
+    if (!rotate())
+    {
+        failed_ = true;
+        return;
+    }
+    compacting_ = true;
+    compactor_ = std::thread(&tx_journal::run_compaction, this, snapshot);
+}
+
+void tx_journal::run_compaction(tx_snapshot snapshot)
+{
+    while (true)
+    {
+        auto write = [&snapshot](const tx_db::sink_fn& sink)
+        {
+            return snapshot.serialize_to(sink);
+        };
+        if (replace_file(path_, write))
+            unlink(old_path_.c_str());
+        else
+            failed_ = true;
+
+        // Go around again if more compactions were requested meanwhile:
+        tx_db::write_lock lock(db_.mutex_);
+        if (!compact_again_ || this != db_.journal_)
+        {
+            compacting_ = false;
+            return;
+        }
+        compact_again_ = false;
+        snapshot = db_.make_snapshot();
+        if (!rotate())
+        {
+            failed_ = true;
+            compacting_ = false;
+            return;
+        }
+    }
+}
+
+} // namespace libwallet
+
@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2011-2014 libbitcoin developers (see AUTHORS)
+ *
+ * This file is part of libbitcoin-watcher.
+ *
+ * libbitcoin-watcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <bitcoin/watcher/tx_sharded_db.hpp>
+#include "file_util.hpp"
+#include <algorithm>
+
+namespace libwallet {
+
+BC_API tx_sharded_db::~tx_sharded_db()
+{
+}
+
+BC_API tx_sharded_db::tx_sharded_db(unsigned shards,
+    unsigned unconfirmed_timeout)
+  : unconfirmed_timeout_(unconfirmed_timeout),
+    scripts_(std::make_shared<script_pool>()),
+    routes_(new std::mutex[std::max(1u, shards)])
+{
+    shards = std::max(1u, shards);
+    shards_.reserve(shards);
+    for (unsigned i = 0; i < shards; ++i)
+        shards_.emplace_back(
+            new tx_db(unconfirmed_timeout, false, scripts_, true));
+}
+
+size_t tx_sharded_db::shard_count() const
+{
+    return shards_.size();
+}
+
+size_t tx_sharded_db::last_height()
+{
+    size_t out = 0;
+    for (auto& shard: shards_)
+        out = std::max(out, shard->last_height());
+    return out;
+}
+
+bool tx_sharded_db::has_tx(bc::hash_digest tx_hash)
+{
+    return shard_for(tx_hash).has_tx(tx_hash);
+}
+
+bc::transaction_type tx_sharded_db::get_tx(bc::hash_digest tx_hash)
+{
+    return shard_for(tx_hash).get_tx(tx_hash);
+}
+
+tx_ptr tx_sharded_db::get_tx_ptr(bc::hash_digest tx_hash)
+{
+    return shard_for(tx_hash).get_tx_ptr(tx_hash);
+}
+
+size_t tx_sharded_db::get_tx_height(bc::hash_digest tx_hash)
+{
+    return shard_for(tx_hash).get_tx_height(tx_hash);
+}
+
+bool tx_sharded_db::is_spend(bc::hash_digest tx_hash,
+    const address_set& addresses)
+{
+    return shard_for(tx_hash).is_spend(tx_hash, addresses);
+}
+
+bool tx_sharded_db::has_history(const bc::payment_address& address)
+{
+    for (auto& shard: shards_)
+        if (shard->has_history(address))
+            return true;
+    return false;
+}
+
+bc::output_info_list tx_sharded_db::get_utxos()
+{
+    bc::output_info_list out;
+    for (auto& shard: shards_)
+    {
+        auto part = shard->get_utxos();
+        out.insert(out.end(), part.begin(), part.end());
+    }
+    return out;
+}
+
+bc::output_info_list tx_sharded_db::get_utxos(const address_set& addresses)
+{
+    bc::output_info_list out;
+    for (auto& shard: shards_)
+    {
+        auto part = shard->get_utxos(addresses);
+        out.insert(out.end(), part.begin(), part.end());
+    }
+    return out;
+}
+
+output_point_list tx_sharded_db::get_history(
+    const bc::payment_address& address)
+{
+    output_point_list out;
+    for (auto& shard: shards_)
+    {
+        auto part = shard->get_history(address);
+        out.insert(out.end(), part.begin(), part.end());
+    }
+    return out;
+}
+
+tx_snapshot tx_sharded_db::snapshot()
+{
+    // Each shard keeps its own snapshot cache,
+    // so this only copies the shards that changed:
+    lock_list locks;
+    locks.reserve(shards_.size());
+    tx_snapshot::part_list parts;
+    for (auto& shard: shards_)
+    {
+        locks.emplace_back(shard->mutex_);
+        parts.push_back(shard->snapshot_part());
+    }
+    return tx_snapshot(std::move(parts));
+}
+
+bc::data_chunk tx_sharded_db::serialize(unsigned threads)
+{
+    lock_list locks;
+    size_t last_height;
+    auto order = save_order(locks, last_height);
+
+    // Work out the exact size up front, so we only allocate once:
+    bc::data_chunk out;
+    out.reserve(tx_db::serialized_size(order));
+    auto sink = [&out](const uint8_t* data, size_t size)
+    {
+        out.insert(out.end(), data, data + size);
+        return true;
+    };
+    tx_db::write_rows(last_height, order, sink, threads);
+    return out;
+}
+
+bool tx_sharded_db::serialize_to(const tx_db::sink_fn& sink,
+    unsigned threads)
+{
+    lock_list locks;
+    size_t last_height;
+    auto order = save_order(locks, last_height);
+    return tx_db::write_rows(last_height, order, sink, threads);
+}
+
+bool tx_sharded_db::load(const bc::data_chunk& data, unsigned threads)
+{
+    return load_data(data.data(), data.data() + data.size(), threads);
+}
+
+bool tx_sharded_db::load_file(const std::string& path, unsigned threads)
+{
+    // Parse the file straight out of the page cache:
+    mapped_file file(path);
+    if (!file.good())
+        return false;
+    return load_data(file.begin(), file.end(), threads);
+}
+
+uint64_t tx_sharded_db::sequence()
+{
+    uint64_t out = 0;
+    for (auto& shard: shards_)
+        out += shard->sequence();
+    return out;
+}
+
+script_pool_stats tx_sharded_db::script_usage()
+{
+    return scripts_->stats();
+}
+
+void tx_sharded_db::dump(std::ostream& out)
+{
+    out << "height: " << last_height() << std::endl;
+    for (auto& shard: shards_)
+    {
+        tx_db::read_lock lock(shard->mutex_);
+        shard->dump_rows(out);
+    }
+}
+
+bool tx_sharded_db::insert(const bc::transaction_type& tx, tx_state state)
+{
+    auto tx_hash = bc::hash_transaction(tx);
+    std::lock_guard<std::mutex> route(routes_[shard_index(tx_hash)]);
+    if (!shard_for(tx_hash).insert_hashed(tx_hash, tx, state))
+        return false;
+
+    std::vector<tx_db::spend_list> spends(shards_.size());
+    add_spends(spends, tx_hash, tx);
+    route_spends(spends, true);
+    return true;
+}
+
+std::vector<bool> tx_sharded_db::insert_batch(
+    const tx_entry_list& entries)
+{
+    // Hash everything once, and hand each shard its part of the batch:
+    std::vector<hash_list> hashes(shards_.size());
+    std::vector<std::vector<const tx_db::tx_entry*>> parts(shards_.size());
+    std::vector<std::vector<size_t>> positions(shards_.size());
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        auto tx_hash = bc::hash_transaction(entries[i].first);
+        auto shard = shard_index(tx_hash);
+        hashes[shard].push_back(tx_hash);
+        parts[shard].push_back(&entries[i]);
+        positions[shard].push_back(i);
+    }
+
+    route_lock_list routes;
+    for (size_t shard = 0; shard < shards_.size(); ++shard)
+        if (!parts[shard].empty())
+            routes.emplace_back(routes_[shard]);
+
+    std::vector<bool> added(entries.size(), false);
+    std::vector<tx_db::spend_list> spends(shards_.size());
+    for (size_t shard = 0; shard < shards_.size(); ++shard)
+    {
+        if (parts[shard].empty())
+            continue;
+        auto part = shards_[shard]->insert_hashed(hashes[shard], parts[shard]);
+        for (size_t i = 0; i < part.size(); ++i)
+        {
+            added[positions[shard][i]] = part[i];
+            if (part[i])
+                add_spends(spends, hashes[shard][i], parts[shard][i]->first);
+        }
+    }
+    route_spends(spends, true);
+    return added;
+}
+
+void tx_sharded_db::at_height(size_t height)
+{
+    for (auto& shard: shards_)
+        shard->at_height(height);
+}
+
+void tx_sharded_db::confirmed(bc::hash_digest tx_hash, size_t block_height)
+{
+    // A confirmed transaction moving blocks means the chain has forked.
+    // Its own shard notices, but the others need telling:
+    auto& shard = shard_for(tx_hash);
+    auto old_height = shard.get_tx_height(tx_hash);
+    shard.confirmed(tx_hash, block_height);
+    if (old_height && old_height != block_height)
+        fork_check(old_height, &shard);
+}
+
+void tx_sharded_db::unconfirmed(bc::hash_digest tx_hash)
+{
+    auto& shard = shard_for(tx_hash);
+    auto old_height = shard.get_tx_height(tx_hash);
+    shard.unconfirmed(tx_hash);
+    if (old_height)
+        fork_check(old_height, &shard);
+}
+
+void tx_sharded_db::forget(bc::hash_digest tx_hash)
+{
+    std::vector<tx_db::spend_list> spends(shards_.size());
+    tx_db::spend_list made;
+    std::lock_guard<std::mutex> route(routes_[shard_index(tx_hash)]);
+    shard_for(tx_hash).forget(tx_hash, made);
+    for (const auto& spend: made)
+        spends[shard_index(spend.first.hash)].push_back(spend);
+    route_spends(spends, false);
+}
+
+void tx_sharded_db::reset_timestamp(bc::hash_digest tx_hash)
+{
+    shard_for(tx_hash).reset_timestamp(tx_hash);
+}
+
+void tx_sharded_db::foreach_unconfirmed(hash_fn&& f)
+{
+    for (auto& shard: shards_)
+        shard->foreach_unconfirmed(hash_fn(f));
+}
+
+void tx_sharded_db::foreach_forked(hash_fn&& f)
+{
+    for (auto& shard: shards_)
+        shard->foreach_forked(hash_fn(f));
+}
+
+void tx_sharded_db::foreach_unsent(tx_fn&& f)
+{
+    for (auto& shard: shards_)
+        shard->foreach_unsent(tx_fn(f));
+}
+
+/**
+ * Picks a shard from the last bytes of the hash. The row tables inside
+ * each shard hash the leading bytes, so this keeps them evenly spread.
+ */
+size_t tx_sharded_db::shard_index(const bc::hash_digest& tx_hash) const
+{
+    return tx_db::shard_index(tx_hash, shards_.size());
+}
+
+tx_db& tx_sharded_db::shard_for(const bc::hash_digest& tx_hash)
+{
+    return *shards_[shard_index(tx_hash)];
+}
+
+/**
+ * Sorts a transaction's spends by the shard holding each spent output.
+ */
+void tx_sharded_db::add_spends(std::vector<tx_db::spend_list>& out,
+    const bc::hash_digest& tx_hash, const bc::transaction_type& tx)
+{
+    for (const auto& input: tx.inputs)
+        out[shard_index(input.previous_output.hash)].emplace_back(
+            input.previous_output, tx_hash);
+}
+
+/**
+ * Hands each shard the spends of its outputs, taking each lock once.
+ * The caller holds the route locks of the spenders' shards, so spends
+ * from one transaction's insert and forget reach each shard in order.
+ */
+void tx_sharded_db::route_spends(const std::vector<tx_db::spend_list>& spends,
+    bool add)
+{
+    for (size_t i = 0; i < shards_.size(); ++i)
+    {
+        if (spends[i].empty())
+            continue;
+        if (add)
+            shards_[i]->add_spends(spends[i]);
+        else
+            shards_[i]->remove_spends(spends[i]);
+    }
+}
+
+/**
+ * Runs a fork check below the given height on every shard but one.
+ */
+void tx_sharded_db::fork_check(size_t height, const tx_db* skip)
+{
+    for (auto& shard: shards_)
+        if (shard.get() != skip)
+            shard->fork_check(height);
+}
+
+/**
+ * Decodes a saved database once, and then deals it out to the shards.
+ */
+bool tx_sharded_db::load_data(const uint8_t* begin, const uint8_t* end,
+    unsigned threads)
+{
+    // Files in the old watcher format load as nothing, leaving us as-is:
+    if (tx_db::is_legacy_data(begin, end))
+        return true;
+
+    // The shards share a script pool, so any of them can do the decoding:
+    size_t last_height;
+    tx_db::row_map rows;
+    tx_db::arena_list arenas;
+    if (!shards_.front()->decode_data(begin, end, threads, last_height,
+        rows, arenas))
+        return false;
+    split(last_height, rows, arenas);
+    return true;
+}
+
+/**
+ * Read-locks every shard, and gathers their rows in save order.
+ * Writers only ever hold one shard lock at a time, so taking them all
+ * in order can't deadlock.
+ */
+tx_db::row_list tx_sharded_db::save_order(lock_list& locks,
+    size_t& last_height)
+{
+    tx_db::row_list out;
+    last_height = 0;
+    locks.reserve(shards_.size());
+    for (auto& shard: shards_)
+    {
+        locks.emplace_back(shard->mutex_);
+        auto part = tx_db::save_order(shard->rows_, unconfirmed_timeout_);
+        out.insert(out.end(), part.begin(), part.end());
+        last_height = std::max(last_height, shard->last_height_);
+    }
+    tx_db::sort_order(out);
+    return out;
+}
+
+/**
+ * Deals the rows of a freshly-decoded database out to the shards,
+ * along with the spends of each shard's outputs.
+ * Each shard swaps in its part on its own, so a reader can briefly see
+ * some shards loaded and others not.
+ */
+void tx_sharded_db::split(size_t last_height, const tx_db::row_map& rows,
+    const tx_db::arena_list& arenas)
+{
+    std::vector<tx_db::row_map> parts(shards_.size());
+    std::vector<tx_db::spend_list> spends(shards_.size());
+    for (auto& part: parts)
+        part.reserve(rows.size() / shards_.size() + 1);
+    for (const auto& row: rows)
+    {
+        parts[shard_index(row.first)].insert(tx_db::row_map::value_type(row));
+        const auto& data = *row.second.data;
+        for (size_t i = 0; i < data.input_count; ++i)
+        {
+            auto point = data.input(i).previous_output();
+            spends[shard_index(point.hash)].emplace_back(point, row.first);
+        }
+    }
+
+    // Keep inserts and forgets from routing spends into the new tables
+    // that belong with the old ones. The old rows end up in `parts`,
+    // and get freed outside the locks:
+    route_lock_list routes;
+    for (size_t i = 0; i < shards_.size(); ++i)
+        routes.emplace_back(routes_[i]);
+    for (size_t i = 0; i < shards_.size(); ++i)
+        shards_[i]->replace_rows(last_height, parts[i], arenas, &spends[i]);
+}
+
+} // namespace libwallet
+
@@ -26,7 +26,7 @@ BC_API tx_updater::~tx_updater()
 {
 }
 
-BC_API tx_updater::tx_updater(tx_db& db, bc::client::obelisk_codec& codec,
+BC_API tx_updater::tx_updater(tx_store& db, bc::client::obelisk_codec& codec,
     tx_callbacks& callbacks)
   : db_(db), codec_(codec),
     callbacks_(callbacks),
@@ -119,10 +119,21 @@ bc::client::sleep_time tx_updater::wakeup()
 void tx_updater::watch(bc::hash_digest tx_hash, bool want_inputs)
 {
     db_.reset_timestamp(tx_hash);
-    if (!db_.has_tx(tx_hash))
+
+    // The transaction might still be waiting to enter the database:
+    auto pending = pending_.find(tx_hash);
+    if (pending != pending_.end())
+    {
+        if (want_inputs)
+            get_inputs(pending->second.tx);
+        return;
+    }
+
+    auto tx = db_.get_tx_ptr(tx_hash);
+    if (!tx)
         get_tx(tx_hash, want_inputs);
     else if (want_inputs)
-        get_inputs(db_.get_tx(tx_hash));
+        get_inputs(*tx);
 }
 
 void tx_updater::get_inputs(const bc::transaction_type& tx)
@@ -135,7 +146,10 @@ void tx_updater::query_done()
 {
     --queued_queries_;
     if (!queued_queries_)
+    {
+        flush_pending();
         callbacks_.on_quiet();
+    }
 }
 
 void tx_updater::queue_get_indices()
@@ -145,6 +159,47 @@ void tx_updater::queue_get_indices()
     db_.foreach_forked(std::bind(&tx_updater::get_index, this, _1));
 }
 
+void tx_updater::add_pending(const bc::transaction_type& tx)
+{
+    auto tx_hash = bc::hash_transaction(tx);
+    if (!db_.has_tx(tx_hash))
+        pending_.emplace(tx_hash,
+            pending_tx{tx, tx_state::unconfirmed, 0});
+}
+
+/**
+ * Moves all pending transactions into the database in one batch,
+ * along with any index results that arrived while they waited.
+ */
+void tx_updater::flush_pending()
+{
+    if (pending_.empty())
+        return;
+
+    tx_store::tx_entry_list entries;
+    entries.reserve(pending_.size());
+    std::vector<std::pair<bc::hash_digest, size_t>> confirmed;
+    for (auto& row: pending_)
+    {
+        if (tx_state::confirmed == row.second.state)
+            confirmed.emplace_back(row.first, row.second.block_height);
+        entries.push_back(tx_store::tx_entry(std::move(row.second.tx),
+            tx_state::unconfirmed));
+    }
+    pending_.clear();
+
+    auto added = db_.insert_batch(entries);
+    for (const auto& row: confirmed)
+        db_.confirmed(row.first, row.second);
+
+    tx_list txs;
+    for (size_t i = 0; i < entries.size(); ++i)
+        if (added[i])
+            txs.push_back(std::move(entries[i].first));
+    if (txs.size())
+        callbacks_.on_add_batch(txs);
+}
+
 // - server queries --------------------
 
 void tx_updater::get_height()
@@ -186,8 +241,7 @@ void tx_updater::get_tx(bc::hash_digest tx_hash, bool want_inputs)
     auto on_done = [this, tx_hash, want_inputs](const bc::transaction_type& tx)
     {
         BITCOIN_ASSERT(tx_hash == bc::hash_transaction(tx));
-        if (db_.insert(tx, tx_state::unconfirmed))
-            callbacks_.on_add(tx);
+        add_pending(tx);
         if (want_inputs)
             get_inputs(tx);
         get_index(tx_hash);
@@ -211,8 +265,7 @@ void tx_updater::get_tx_mem(bc::hash_digest tx_hash, bool want_inputs)
     auto on_done = [this, tx_hash, want_inputs](const bc::transaction_type& tx)
     {
         BITCOIN_ASSERT(tx_hash == bc::hash_transaction(tx));
-        if (db_.insert(tx, tx_state::unconfirmed))
-            callbacks_.on_add(tx);
+        add_pending(tx);
         if (want_inputs)
             get_inputs(tx);
         get_index(tx_hash);
@@ -228,9 +281,11 @@ void tx_updater::get_index(bc::hash_digest tx_hash)
 
     auto on_error = [this, tx_hash](const std::error_code& error)
     {
-        // A failure means that the transaction is unconfirmed:
+        // A failure means that the transaction is unconfirmed.
+        // Pending transactions go in that way already:
         (void)error;
-        db_.unconfirmed(tx_hash);
+        if (!pending_.count(tx_hash))
+            db_.unconfirmed(tx_hash);
 
         --queued_get_indices_;
         queue_get_indices();
@@ -238,10 +293,17 @@ void tx_updater::get_index(bc::hash_digest tx_hash)
 
     auto on_done = [this, tx_hash](size_t block_height, size_t index)
     {
-        // The transaction is confirmed:
+        // The transaction is confirmed. If it is still pending,
+        // hold on to the height until the next flush:
         (void)index;
-
-        db_.confirmed(tx_hash, block_height);
+        auto pending = pending_.find(tx_hash);
+        if (pending != pending_.end())
+        {
+            pending->second.state = tx_state::confirmed;
+            pending->second.block_height = block_height;
+        }
+        else
+            db_.confirmed(tx_hash, block_height);
 
         --queued_get_indices_;
         queue_get_indices();